@@ -0,0 +1,86 @@
+/* 
+ * File:   AllocationCounter.cpp
+ * Author: John Shelnutt
+ * Synopsis: Implements the allocation counter - every replaceable form of operator new and delete, on malloc and free
+ */
+
+#include "AllocationCounter.h"
+#include <atomic>
+#include <cstdlib>
+#include <new>
+using namespace std;
+
+// Relaxed: threads only need their increments to add up, nothing is ordered by the count
+static atomic<unsigned long long> allocations(0);
+
+unsigned long long allocationCount() {
+    return allocations.load(memory_order_relaxed);
+}
+
+// Helper functions
+void* countedAlloc(size_t size) {
+    allocations.fetch_add(1, memory_order_relaxed);
+    return malloc(size ? size : 1);
+}
+
+void* countedAlignedAlloc(size_t size, align_val_t alignment) {
+    allocations.fetch_add(1, memory_order_relaxed);
+    size_t a = (size_t)alignment < sizeof(void*) ? sizeof(void*) : (size_t)alignment;
+    void* p = nullptr;
+    if (posix_memalign(&p, a, size ? size : 1) != 0) {return nullptr;}
+    return p;
+}
+
+void* operator new(size_t size) {
+    void* p = countedAlloc(size);
+    if (!p) {throw bad_alloc();}
+    return p;
+}
+
+void* operator new[](size_t size) {
+    void* p = countedAlloc(size);
+    if (!p) {throw bad_alloc();}
+    return p;
+}
+
+void* operator new(size_t size, const nothrow_t&) noexcept {
+    return countedAlloc(size);
+}
+
+void* operator new[](size_t size, const nothrow_t&) noexcept {
+    return countedAlloc(size);
+}
+
+void* operator new(size_t size, align_val_t alignment) {
+    void* p = countedAlignedAlloc(size, alignment);
+    if (!p) {throw bad_alloc();}
+    return p;
+}
+
+void* operator new[](size_t size, align_val_t alignment) {
+    void* p = countedAlignedAlloc(size, alignment);
+    if (!p) {throw bad_alloc();}
+    return p;
+}
+
+void* operator new(size_t size, align_val_t alignment, const nothrow_t&) noexcept {
+    return countedAlignedAlloc(size, alignment);
+}
+
+void* operator new[](size_t size, align_val_t alignment, const nothrow_t&) noexcept {
+    return countedAlignedAlloc(size, alignment);
+}
+
+// posix_memalign memory is released with free too, so every delete is the same
+void operator delete(void* p) noexcept {free(p);}
+void operator delete[](void* p) noexcept {free(p);}
+void operator delete(void* p, size_t) noexcept {free(p);}
+void operator delete[](void* p, size_t) noexcept {free(p);}
+void operator delete(void* p, const nothrow_t&) noexcept {free(p);}
+void operator delete[](void* p, const nothrow_t&) noexcept {free(p);}
+void operator delete(void* p, align_val_t) noexcept {free(p);}
+void operator delete[](void* p, align_val_t) noexcept {free(p);}
+void operator delete(void* p, size_t, align_val_t) noexcept {free(p);}
+void operator delete[](void* p, size_t, align_val_t) noexcept {free(p);}
+void operator delete(void* p, align_val_t, const nothrow_t&) noexcept {free(p);}
+void operator delete[](void* p, align_val_t, const nothrow_t&) noexcept {free(p);}
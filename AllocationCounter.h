@@ -0,0 +1,19 @@
+/* 
+ * File:   AllocationCounter.h
+ * Author: John Shelnutt
+ * Synopsis: Header file for the allocation counter - replaces the global operator new of the programs it is linked into and counts every heap allocation they make
+ */
+
+#ifndef ALLOCATIONCOUNTER_H
+#define ALLOCATIONCOUNTER_H
+
+using namespace std;
+
+/*
+ * Heap allocations made so far by every thread of the process
+ * Only for the benchmarks and tests: linking AllocationCounter.cpp replaces operator new, so it is not part of the
+ * calculator library.
+ */
+unsigned long long allocationCount();
+
+#endif /* ALLOCATIONCOUNTER_H */
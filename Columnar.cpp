@@ -0,0 +1,281 @@
+/* 
+ * File:   Columnar.cpp
+ * Author: John Shelnutt
+ * Synopsis: Evaluates a program over blocks of rows. Every operand stack entry is either a pointer to a block of values or a
+ *           single value shared by all rows, so bound columns are read in place and literals are never expanded.
+ *           +, - and * run on AVX2 or SSE4.1 kernels picked at run time, / and % stay scalar and report division by zero
+ *           and INT_MIN / -1 for the row instead of trapping.
+ */
+
+#include "Columnar.h"
+#include <cstring>
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#include <immintrin.h>
+#define COLUMNAR_X86 1
+#endif
+using namespace std;
+
+// Rows evaluated together, small enough that the whole operand stack of blocks stays in cache
+const size_t BLOCK_ROWS = 512;
+
+ColumnBindings::ColumnBindings(const SymbolTable& symbols) : symbols(symbols) {
+}
+
+void ColumnBindings::bind(int id, const int32_t* column) {
+    if (id >= (int)columns.size()) {
+        columns.resize(id + 1, nullptr);
+    }
+    columns[id] = column;
+}
+
+void ColumnBindings::unbind(int id) {
+    if (id < (int)columns.size()) {
+        columns[id] = nullptr;
+    }
+}
+
+const int32_t* ColumnBindings::get_column(int id) const {
+    return id < (int)columns.size() ? columns[id] : nullptr;
+}
+
+int ColumnBindings::get_scalar(int id) const {
+    return symbols.get_value(id);
+}
+
+// Whether variable id has a value in every row: a column or a defined value in the table
+bool ColumnBindings::is_available(int id) const {
+    return get_column(id) || symbols.is_defined(id);
+}
+
+// Kernels: vv = block op block, vs = block op value, sv = value op block. Arithmetic wraps like the hardware does.
+struct Kernels {
+    const char* name;
+    void (*vv[3])(const int32_t* a, const int32_t* b, int32_t* out, size_t n);
+    void (*vs[3])(const int32_t* a, int32_t b, int32_t* out, size_t n);
+    void (*sv[3])(int32_t a, const int32_t* b, int32_t* out, size_t n);
+};
+
+// Index of ADD, SUB and MUL in the kernel tables
+inline int kernelIndex(Opcode op) {
+    return op == ADD ? 0 : op == SUB ? 1 : 2;
+}
+
+inline int32_t wrap(uint32_t v) {
+    return (int32_t)v;
+}
+
+template <int K>
+inline int32_t scalarOp(int32_t a, int32_t b) {
+    return K == 0 ? wrap((uint32_t)a + (uint32_t)b) : K == 1 ? wrap((uint32_t)a - (uint32_t)b) : wrap((uint32_t)a * (uint32_t)b);
+}
+
+template <int K>
+void scalarVV(const int32_t* a, const int32_t* b, int32_t* out, size_t n) {
+    for (size_t i = 0; i < n; i++) {out[i] = scalarOp<K>(a[i], b[i]);}
+}
+
+template <int K>
+void scalarVS(const int32_t* a, int32_t b, int32_t* out, size_t n) {
+    for (size_t i = 0; i < n; i++) {out[i] = scalarOp<K>(a[i], b);}
+}
+
+template <int K>
+void scalarSV(int32_t a, const int32_t* b, int32_t* out, size_t n) {
+    for (size_t i = 0; i < n; i++) {out[i] = scalarOp<K>(a, b[i]);}
+}
+
+const Kernels scalarKernels = {
+    "scalar",
+    {scalarVV<0>, scalarVV<1>, scalarVV<2>},
+    {scalarVS<0>, scalarVS<1>, scalarVS<2>},
+    {scalarSV<0>, scalarSV<1>, scalarSV<2>},
+};
+
+#ifdef COLUMNAR_X86
+
+// The same three kernels for SSE4.1 (4 lanes) and AVX2 (8 lanes); the scalar loop finishes the tail
+#define VECTOR_KERNELS(ISA, TARGET, VEC, LANES, LOAD, STORE, SET1, ADD, SUB, MUL)                         \
+    template <int K>                                                                                     \
+    __attribute__((target(TARGET))) inline VEC ISA##Op(VEC a, VEC b) {                                   \
+        return K == 0 ? ADD(a, b) : K == 1 ? SUB(a, b) : MUL(a, b);                                      \
+    }                                                                                                    \
+    template <int K>                                                                                     \
+    __attribute__((target(TARGET))) void ISA##VV(const int32_t* a, const int32_t* b, int32_t* out, size_t n) { \
+        size_t i = 0;                                                                                    \
+        for (; i + LANES <= n; i += LANES) {                                                             \
+            STORE((VEC*)(out + i), ISA##Op<K>(LOAD((const VEC*)(a + i)), LOAD((const VEC*)(b + i))));     \
+        }                                                                                                \
+        scalarVV<K>(a + i, b + i, out + i, n - i);                                                       \
+    }                                                                                                    \
+    template <int K>                                                                                     \
+    __attribute__((target(TARGET))) void ISA##VS(const int32_t* a, int32_t b, int32_t* out, size_t n) {  \
+        size_t i = 0;                                                                                    \
+        VEC vb = SET1(b);                                                                                \
+        for (; i + LANES <= n; i += LANES) {                                                             \
+            STORE((VEC*)(out + i), ISA##Op<K>(LOAD((const VEC*)(a + i)), vb));                            \
+        }                                                                                                \
+        scalarVS<K>(a + i, b, out + i, n - i);                                                           \
+    }                                                                                                    \
+    template <int K>                                                                                     \
+    __attribute__((target(TARGET))) void ISA##SV(int32_t a, const int32_t* b, int32_t* out, size_t n) {  \
+        size_t i = 0;                                                                                    \
+        VEC va = SET1(a);                                                                                \
+        for (; i + LANES <= n; i += LANES) {                                                             \
+            STORE((VEC*)(out + i), ISA##Op<K>(va, LOAD((const VEC*)(b + i))));                            \
+        }                                                                                                \
+        scalarSV<K>(a, b + i, out + i, n - i);                                                           \
+    }                                                                                                    \
+    const Kernels ISA##Kernels = {                                                                       \
+        #ISA,                                                                                            \
+        {ISA##VV<0>, ISA##VV<1>, ISA##VV<2>},                                                            \
+        {ISA##VS<0>, ISA##VS<1>, ISA##VS<2>},                                                            \
+        {ISA##SV<0>, ISA##SV<1>, ISA##SV<2>},                                                            \
+    };
+
+VECTOR_KERNELS(sse41, "sse4.1", __m128i, 4, _mm_loadu_si128, _mm_storeu_si128, _mm_set1_epi32,
+               _mm_add_epi32, _mm_sub_epi32, _mm_mullo_epi32)
+VECTOR_KERNELS(avx2, "avx2", __m256i, 8, _mm256_loadu_si256, _mm256_storeu_si256, _mm256_set1_epi32,
+               _mm256_add_epi32, _mm256_sub_epi32, _mm256_mullo_epi32)
+
+#endif
+
+// Picks the widest kernels the CPU supports, once
+const Kernels& kernels() {
+    static const Kernels* chosen = []() {
+#ifdef COLUMNAR_X86
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2")) {return &avx2Kernels;}
+        if (__builtin_cpu_supports("sse4.1")) {return &sse41Kernels;}
+#endif
+        return &scalarKernels;
+    }();
+    return *chosen;
+}
+
+const char* columnKernelName() {
+    return kernels().name;
+}
+
+// Operand stack entry for a block of rows
+struct Column {
+    const int32_t* values; // nullptr when every row has the same value
+    int32_t scalar;
+};
+
+// Records error for every row of the block that has none yet
+inline void failRows(unsigned char* errors, size_t n, EvalStatus error, size_t& failed) {
+    for (size_t i = 0; i < n; i++) {
+        if (errors[i] == EVAL_OK) {
+            errors[i] = (unsigned char)error;
+            failed++;
+        }
+    }
+}
+
+/*
+ * Function to evaluate the program for every row
+ * out[r] is what get_result returns with each bound variable set to its column's value at row r. A row that divides by
+ * zero or takes INT_MIN / -1 gets 0 instead, and its status (in status[r] if status is given) says why; the first of
+ * those statuses in row order is returned. Returns EVAL_UNDEFINED and writes nothing if a variable the program reads is
+ * neither bound nor defined.
+ */
+EvalStatus evaluateColumns(const Program& program, const ColumnBindings& bindings, size_t rows, int32_t* out,
+                           EvalStatus* status) {
+    const pmr::vector<Instruction>& code = program.get_code();
+    if (code.empty()) {return EVAL_OK;}
+    for (const Instruction& instr : code) {
+        if (instr.op == LOAD_SLOT && !bindings.is_available(instr.operand)) {return EVAL_UNDEFINED;}
+    }
+    
+    const Kernels& k = kernels();
+    int depth = program.get_max_depth();
+    // one block of scratch per stack level, kept per thread and only grown for a deeper program than it has seen
+    static thread_local vector<int32_t> storage;
+    static thread_local vector<Column> stack;
+    if (stack.size() < (size_t)depth) {
+        storage.resize((size_t)depth * BLOCK_ROWS);
+        stack.resize(depth);
+    }
+    unsigned char errors[BLOCK_ROWS];
+    EvalStatus first = EVAL_OK;
+    
+    for (size_t start = 0; start < rows; start += BLOCK_ROWS) {
+        size_t n = rows - start < BLOCK_ROWS ? rows - start : BLOCK_ROWS;
+        int top = -1;
+        size_t failed = 0; // rows of the block with an error
+        memset(errors, EVAL_OK, n);
+        
+        for (size_t pc = 0; pc < code.size(); pc++) {
+            const Instruction& instr = code[pc];
+            if (instr.op == PUSH_CONST) {
+                Column c = {nullptr, instr.operand};
+                stack[++top] = c;
+                continue;
+            }
+            if (instr.op == LOAD_SLOT) {
+                const int32_t* column = bindings.get_column(instr.operand);
+                Column c = {column ? column + start : nullptr, column ? 0 : bindings.get_scalar(instr.operand)};
+                stack[++top] = c;
+                continue;
+            }
+            
+            Column b = stack[top--];
+            Column a = stack[top];
+            int32_t* dest = &storage[(size_t)top * BLOCK_ROWS];
+            
+            if (!a.values && !b.values) {
+                int32_t r = 0;
+                if (instr.op == DIV || instr.op == MOD) {
+                    EvalStatus s = applyOperator<CheckedInt32Arithmetic>(instr.op, a.scalar, b.scalar, r);
+                    if (s != EVAL_OK) {failRows(errors, n, s, failed);}
+                } else {
+                    r = evaluate(a.scalar, b.scalar, instr.op);
+                }
+                stack[top].scalar = r;
+            } else if (instr.op == DIV || instr.op == MOD) {
+                // The checked policy's / and % never trap, a row that fails keeps whatever it had and is reported
+                for (size_t i = 0; i < n; i++) {
+                    int32_t r = 0;
+                    EvalStatus s = applyOperator<CheckedInt32Arithmetic>(instr.op, a.values ? a.values[i] : a.scalar,
+                                                                         b.values ? b.values[i] : b.scalar, r);
+                    dest[i] = r;
+                    if (s != EVAL_OK && errors[i] == EVAL_OK) {
+                        errors[i] = (unsigned char)s;
+                        failed++;
+                    }
+                }
+                stack[top].values = dest;
+            } else {
+                int ki = kernelIndex(instr.op);
+                if (a.values && b.values) {
+                    k.vv[ki](a.values, b.values, dest, n);
+                } else if (a.values) {
+                    k.vs[ki](a.values, b.scalar, dest, n);
+                } else {
+                    k.sv[ki](a.scalar, b.values, dest, n);
+                }
+                stack[top].values = dest;
+            }
+        }
+        
+        if (stack[0].values) {
+            memcpy(out + start, stack[0].values, n * sizeof(int32_t));
+        } else {
+            for (size_t i = 0; i < n; i++) {
+                out[start + i] = stack[0].scalar;
+            }
+        }
+        for (size_t i = 0; failed != 0 && i < n; i++) {
+            if (errors[i] != EVAL_OK) {
+                out[start + i] = 0;
+                if (first == EVAL_OK) {first = (EvalStatus)errors[i];}
+            }
+        }
+        if (status) {
+            for (size_t i = 0; i < n; i++) {
+                status[start + i] = (EvalStatus)errors[i];
+            }
+        }
+    }
+    return first;
+}
@@ -0,0 +1,34 @@
+/* 
+ * File:   Columnar.h
+ * Author: John Shelnutt
+ * Synopsis: Header file for columnar evaluation - one compiled program evaluated over many rows at once, with variables bound to contiguous int32 arrays
+ */
+
+#ifndef COLUMNAR_H
+#define COLUMNAR_H
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include "Program.h"
+#include "SymbolTable.h"
+using namespace std;
+
+class ColumnBindings {
+public:
+    ColumnBindings(const SymbolTable& symbols);
+    void bind(int id, const int32_t* column);
+    void unbind(int id);
+    const int32_t* get_column(int id) const;
+    int get_scalar(int id) const;
+    bool is_available(int id) const;
+private:
+    const SymbolTable& symbols;       // variables without a column take their value from the table in every row
+    vector<const int32_t*> columns;   // indexed by symbol id, nullptr = not bound
+};
+
+EvalStatus evaluateColumns(const Program& program, const ColumnBindings& bindings, size_t rows, int32_t* out,
+                           EvalStatus* status = nullptr);
+const char* columnKernelName();
+
+#endif /* COLUMNAR_H */
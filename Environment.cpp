@@ -0,0 +1,168 @@
+/* 
+ * File:   Environment.cpp
+ * Author: John Shelnutt
+ * Synopsis: Implements shared variable environments - copy-on-write versions published with an atomic store, and epoch based reclamation of the versions they replace
+ */
+
+#include "Environment.h"
+#include <vector>
+#include <climits>
+using namespace std;
+
+// The epoch a thread announced when it took its outermost guard, 0 while it holds none. A cache line each.
+struct alignas(64) ReaderSlot {
+    atomic<uint64_t> epoch;
+    bool used;  // a thread owns the slot, guarded by the domain lock
+};
+
+/*
+ * Epoch based reclamation shared by every environment
+ * A replaced version is retired with the epoch it was replaced in, and the epoch moves on. A reader that announced that
+ * epoch or an earlier one may still hold the version. One that announced a later epoch cannot: it loaded the current
+ * version after announcing, and the replacement was published before the epoch moved on.
+ */
+struct EpochDomain {
+    atomic<uint64_t> epoch;
+    mutex lock;  // slots and retired
+    vector<unique_ptr<ReaderSlot> > slots;
+    vector<pair<uint64_t, const EnvironmentVersion*> > retired;
+    
+    EpochDomain() : epoch(1) {}
+    ~EpochDomain() {
+        for (size_t i = 0; i < retired.size(); i++) {
+            delete retired[i].second;
+        }
+    }
+};
+
+EpochDomain& epochDomain() {
+    static EpochDomain d;
+    return d;
+}
+
+// Slot of the calling thread, taken on its first guard and given back when the thread exits
+struct ThreadSlot {
+    ReaderSlot* slot;
+    int depth;  // guards the thread holds
+    
+    ThreadSlot() : slot(nullptr), depth(0) {}
+    ~ThreadSlot() {
+        if (!slot) {return;}
+        EpochDomain& d = epochDomain();
+        lock_guard<mutex> guard(d.lock);
+        slot->used = false;
+    }
+};
+
+thread_local ThreadSlot threadSlot;
+
+ReaderSlot* claimSlot() {
+    EpochDomain& d = epochDomain();
+    lock_guard<mutex> guard(d.lock);
+    for (size_t i = 0; i < d.slots.size(); i++) {
+        if (!d.slots[i]->used) {
+            d.slots[i]->used = true;
+            return d.slots[i].get();
+        }
+    }
+    d.slots.push_back(unique_ptr<ReaderSlot>(new ReaderSlot()));
+    d.slots.back()->epoch.store(0);
+    d.slots.back()->used = true;
+    return d.slots.back().get();
+}
+
+/*
+ * Function to hand a version that is no longer current to the domain
+ * It is freed, together with every earlier one that became safe to free, once all readers announced a later epoch.
+ */
+void retire(const EnvironmentVersion* version) {
+    EpochDomain& d = epochDomain();
+    lock_guard<mutex> guard(d.lock);
+    d.retired.push_back(make_pair(d.epoch.fetch_add(1), version));
+    
+    uint64_t oldest = ULLONG_MAX;
+    for (size_t i = 0; i < d.slots.size(); i++) {
+        uint64_t e = d.slots[i]->epoch.load();
+        if (e != 0 && e < oldest) {oldest = e;}
+    }
+    size_t kept = 0;
+    for (size_t i = 0; i < d.retired.size(); i++) {
+        if (d.retired[i].first < oldest) {
+            delete d.retired[i].second;
+        } else {
+            d.retired[kept++] = d.retired[i];
+        }
+    }
+    d.retired.resize(kept);
+}
+
+// Versions replaced but not freed yet, because a reader may still hold them
+size_t retiredVersions() {
+    EpochDomain& d = epochDomain();
+    lock_guard<mutex> guard(d.lock);
+    return d.retired.size();
+}
+
+EpochGuard::EpochGuard() {
+    ThreadSlot& t = threadSlot;
+    if (t.depth++ > 0) {return;}
+    if (!t.slot) {
+        t.slot = claimSlot();
+    }
+    t.slot->epoch.store(epochDomain().epoch.load());
+}
+
+EpochGuard::~EpochGuard() {
+    ThreadSlot& t = threadSlot;
+    if (--t.depth == 0) {
+        t.slot->epoch.store(0, memory_order_release);
+    }
+}
+
+Environment::Environment(const string& name) : name(name), current(new EnvironmentVersion{1, SymbolTable()}) {
+}
+
+// Nothing may read the environment any more, so its current version is freed right away
+Environment::~Environment() {
+    delete current.load();
+}
+
+const string& Environment::get_name() const {
+    return name;
+}
+
+// The version published last, only valid while the calling thread holds an EpochGuard
+const EnvironmentVersion& Environment::get_current() const {
+    return *current.load();
+}
+
+/*
+ * Function to publish a new version: change gets a copy of the current table and returns whether it changed anything
+ * Writers of the same environment wait for each other, readers are never blocked. Returns the number of the version
+ * that is current afterwards.
+ */
+uint64_t Environment::update(const function<bool(SymbolTable&)>& change) {
+    lock_guard<mutex> guard(writers);
+    const EnvironmentVersion* old = current.load(memory_order_relaxed); // only stored to under writers
+    unique_ptr<EnvironmentVersion> next(new EnvironmentVersion{old->number + 1, old->symbols});
+    if (!change(next->symbols)) {return old->number;}
+    
+    uint64_t number = next->number;
+    current.store(next.release());
+    retire(old); // may free old right away
+    return number;
+}
+
+Environment& EnvironmentStore::get(const string& name) {
+    lock_guard<mutex> guard(lock);
+    unique_ptr<Environment>& e = environments[name];
+    if (!e) {
+        e.reset(new Environment(name));
+    }
+    return *e;
+}
+
+size_t EnvironmentStore::size() const {
+    lock_guard<mutex> guard(lock);
+    return environments.size();
+}
@@ -0,0 +1,74 @@
+/* 
+ * File:   Environment.h
+ * Author: John Shelnutt
+ * Synopsis: Header file for shared variable environments - named look up tables that writers update by publishing new immutable versions, and that readers evaluate against without locks
+ */
+
+#ifndef ENVIRONMENT_H
+#define ENVIRONMENT_H
+
+#include <string>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <functional>
+#include <unordered_map>
+#include <cstdint>
+#include "SymbolTable.h"
+using namespace std;
+
+// One state of an environment, never changed once it is published
+struct EnvironmentVersion {
+    uint64_t number;      // 1 for the empty table an environment starts with
+    SymbolTable symbols;
+};
+
+/*
+ * While an EpochGuard exists on a thread, no version that was current at any time since it was created is freed
+ * Guards nest, only the outermost one on a thread does anything. Creating one is two atomic stores, no lock.
+ */
+class EpochGuard {
+public:
+    EpochGuard();
+    ~EpochGuard();
+private:
+    EpochGuard(const EpochGuard&) = delete;
+    EpochGuard& operator=(const EpochGuard&) = delete;
+};
+
+/*
+ * A named variable table shared by any number of sessions on any number of threads (MVCC)
+ * Readers take get_current() under an EpochGuard and see one consistent version for as long as they hold it. Writers
+ * are serialized per environment: update copies the current table, applies the change to the copy and publishes it
+ * with one atomic store; the version it replaces is freed once no guard that could still see it is left.
+ * Symbol ids only ever get added, so an expression compiled against one version keeps its meaning in every later one.
+ */
+class Environment {
+public:
+    Environment(const string& name);
+    ~Environment();
+    const string& get_name() const;
+    const EnvironmentVersion& get_current() const;
+    uint64_t update(const function<bool(SymbolTable&)>& change);
+private:
+    Environment(const Environment&) = delete;
+    Environment& operator=(const Environment&) = delete;
+
+    string name;
+    atomic<const EnvironmentVersion*> current;
+    mutex writers;
+};
+
+// Environments by name, created on first use and kept until the store is destroyed
+class EnvironmentStore {
+public:
+    Environment& get(const string& name);
+    size_t size() const;
+private:
+    mutable mutex lock;  // only taken to look an environment up, never to read or update one
+    unordered_map<string, unique_ptr<Environment> > environments;
+};
+
+size_t retiredVersions();
+
+#endif /* ENVIRONMENT_H */
@@ -5,31 +5,15 @@
  */
 
 #include "Expression.h"
-#include <stack>
+#include "Parser.h"
+#include "ExpressionTree.h"
+#include "Columnar.h"
+#include "ParseCache.h"
+#include "Stats.h"
 #include <iostream>
 using namespace std;
 
 
-bool isSpecialTok(const char c) {
-    switch (c) {
-        // Operators
-        case '+':
-        case '-':
-        case '*':
-        case '/':
-        case '%':
-        // Assignment
-        case '=':
-        // OpenBrace, CloseBrace
-        case '(':
-        case ')':
-            return true;
-        default:
-            return false;
-            
-    }
-}
-
 string getStringType(const Exp_type t){
     switch (t) {
         case assignment:
@@ -43,306 +27,331 @@ string getStringType(const Exp_type t){
     }
 }
 
-int evaluate(int a, int b, string op) {
-    switch (op[0]) {
-        case '+':
-            return a + b;
-        case '-':
-            return a - b;
-        case '*':
-            return a * b;
-        case '/':
-            return a / b;
-        case '%':
-            return a % b;
-        default:
-            return -1; // Never makes it here
+CompiledExpression::CompiledExpression(pmr::memory_resource* resource) : source(resource), tokenized(resource),
+                                                                        postfix(resource), program(resource) {
+    valid = false;
+    compacted = false;
+    type = illegal;
+    error.message = nullptr;
+    error.position = 0;
+}
+
+// Parses source in one pass and compiles it, variables are interned into symbols
+void CompiledExpression::parse(SymbolTable& symbols) {
+    {
+        STATS_PHASE(PHASE_PARSE);
+        type = parseExpression(source, tokenized, postfix, error);
+        valid = type != illegal;
     }
+    STATS_PHASE(PHASE_COMPILE);
+    program.compile(postfix, source, symbols);
+}
+
+// Re-runs the parser for a compacted form
+pmr::vector<Token> CompiledExpression::restorePostfix() const {
+    pmr::vector<Token> tokens;
+    pmr::vector<Token> out;
+    ParseError ignored;
+    parseExpression(source, tokens, out, ignored);
+    return out;
+}
+
+// Approximate number of bytes the form owns
+size_t CompiledExpression::get_memory() const {
+    return sizeof(CompiledExpression) + source.capacity() + (tokenized.capacity() + postfix.capacity()) * sizeof(Token)
+         + program.get_code().capacity() * sizeof(Instruction) + program.get_variables().capacity() * sizeof(int);
 }
 
-int stringToInt(string s) {
-    istringstream stream(s);
-    int i;
-    stream >> i;
-    return i;
+// The form of the empty expression, shared by every default constructed expression
+const shared_ptr<const CompiledExpression>& emptyForm() {
+    static const shared_ptr<const CompiledExpression> form = [] {
+        shared_ptr<CompiledExpression> f = make_shared<CompiledExpression>();
+        f->error.message = "empty expression";
+        return f;
+    }();
+    return form;
 }
 
 Expression::Expression() {
-    set("");
+    compiled = emptyForm();
 }
 
-Expression::Expression(const string& s) {
-    set(s);
+Expression::Expression(const string& s, SymbolTable& symbols) {
+    set(s, symbols);
 }
 
-void Expression::set(const string& s) {
-    original = s;
-    valid = false;
-    type = illegal;
-    if (original == "") {return;}
+Expression::Expression(const string& s, SymbolTable& symbols, ParseCache& cache) {
+    set(s, symbols, cache);
+}
+
+Expression::Expression(const string& s, SymbolTable& symbols, pmr::memory_resource* resource) {
+    set(s, symbols, resource);
+}
+
+// An expression with text s and a form that was compiled elsewhere, e.g. loaded from a snapshot
+Expression::Expression(string_view s, const shared_ptr<const CompiledExpression>& form) : compiled(form) {
+    if (s != compiled->source) {
+        original = string(s);
+    }
+}
+
+Expression::Expression(const Expression& e) {
+    *this = e;
+}
+
+void Expression::set(const string& s, SymbolTable& symbols) {
+    set(s, symbols, pmr::get_default_resource());
+}
+
+// Same as set(s, symbols), with the compiled form and all of its storage allocated from resource
+void Expression::set(const string& s, SymbolTable& symbols, pmr::memory_resource* resource) {
+    shared_ptr<CompiledExpression> form = allocate_shared<CompiledExpression>(pmr::polymorphic_allocator<CompiledExpression>(resource), resource);
+    form->source = s;
+    form->parse(symbols);
+    compiled = form;
+    original.clear();
+    rendered.reset();
+}
+
+// Same as set(s, symbols), but the compiled form is looked up in the cache first and shared with other expressions
+void Expression::set(const string& s, SymbolTable& symbols, ParseCache& cache) {
+    compiled = cache.get(s, symbols);
+    if (string_view(s) == compiled->source) {
+        original.clear();
+    } else {
+        original = s;
+    }
+    rendered.reset();
+}
+
+/*
+ * Copy-on-write access to the compiled form, a form that other expressions or a parse cache also hold is copied first
+ * Every form is created non-const by make_shared, only the references to it are const
+ */
+CompiledExpression& Expression::ownForm() {
+    if (compiled.use_count() != 1) {
+        compiled = make_shared<CompiledExpression>(*compiled);
+    }
+    return const_cast<CompiledExpression&>(*compiled);
+}
+
+/*
+ * Function to drop everything but the source text and the compiled program
+ * Tokens, postfix and renderings are re-derived from the source on the rare occasions they are needed again.
+ * A shared form is already stored only once and is left alone.
+ */
+void Expression::compact() {
+    rendered.reset();
+    if (compiled.use_count() != 1) {return;}
     
-    setTokens();
-    setType();
-    setPostfix();
-    setPrefix();
-    setParenthesized();
+    CompiledExpression& form = ownForm();
+    form.tokenized.clear();
+    form.tokenized.shrink_to_fit();
+    form.postfix.clear();
+    form.postfix.shrink_to_fit();
+    form.program.shrink();
+    form.compacted = true;
+}
+
+bool Expression::is_compact() const {
+    return compiled->compacted;
+}
+
+// Rewrites the symbol ids of an expression parsed against a different symbol table, see Program::remap
+void Expression::remap_variables(const vector<int>& ids) {
+    ownForm().program.remap(ids);
 }
 
 void Expression::display() const {
-    cout << "original  = " << original << endl
+    const CompiledExpression& c = *compiled;
+    cout << "original  = " << get_original() << endl
          << "tokenized = ";
-    for (Token t : tokenized) {
-        cout << t.get_token() << ",";
+    for (const Token& t : c.tokenized) {
+        cout << t.get_token(c.source) << ",";
     }
     cout << endl 
-         << "number of tokens: " << tokenized.size() << endl
+         << "number of tokens: " << c.tokenized.size() << endl
          << "postfix   = ";
-    for (Token t : postfix) {
-        cout << t.get_token() << ",";
+    for (const Token& t : c.postfix) {
+        cout << t.get_token(c.source) << ",";
     }
     cout << endl
-         << "valid     = " << valid << endl
-         << "type      = " << getStringType(type) << endl;
+         << "valid     = " << c.valid << endl
+         << "type      = " << getStringType(c.type) << endl;
+    if (c.error.message) {
+        cout << "error     = " << c.error.message << " at " << c.error.position << endl;
+    }
+}
+
+string_view Expression::get_original() const {
+    return original.empty() ? string_view(compiled->source) : string_view(original);
+}
+
+// Same as get_original unless the expression came from a parse cache, which collapses runs of spaces
+string_view Expression::get_source() const {
+    return compiled->source;
 }
 
-string Expression::get_original() const {
-    return original;
+const pmr::vector<Token>& Expression::get_tokenized() const {
+    return compiled->tokenized;
 }
 
-vector<Token> Expression::get_tokenized() const {
-    return tokenized;
+const pmr::vector<Token>& Expression::get_postfix() const {
+    return compiled->postfix;
 }
 
-vector<Token> Expression::get_postfix() const {
-    return postfix;
+// Postfix tokens separated by single spaces
+string Expression::get_postfix_string() const {
+    const CompiledExpression& c = *compiled;
+    STATS_PHASE(PHASE_RENDER);
+    string out;
+    if (c.type == arithmetic) {
+        ExpressionTree(c.compacted ? c.restorePostfix() : c.postfix).renderPostfix(c.source, out);
+    }
+    return out;
+}
+
+Expression::Rendering& Expression::getRendering() const {
+    if (!rendered) {
+        rendered.reset(new Rendering());
+        rendered->hasPrefix = false;
+        rendered->hasParenthesized = false;
+    }
+    return *rendered;
 }
 
 string Expression::get_prefix() const {
-    return prefix;
+    const CompiledExpression& c = *compiled;
+    if (c.type != arithmetic) {return "";}
+    STATS_PHASE(PHASE_RENDER);
+    if (c.compacted) { // compacted expressions do not keep renderings around
+        string out;
+        ExpressionTree(c.restorePostfix()).renderPrefix(c.source, out);
+        return out;
+    }
+    
+    Rendering& r = getRendering();
+    if (!r.hasPrefix) {
+        ExpressionTree(c.postfix).renderPrefix(c.source, r.prefix);
+        r.hasPrefix = true;
+    }
+    return r.prefix;
 }
 
 string Expression::get_parenthesized() const {
-    return parenthesized;
+    const CompiledExpression& c = *compiled;
+    if (c.type != arithmetic) {return "";}
+    STATS_PHASE(PHASE_RENDER);
+    if (c.compacted) {
+        string out;
+        ExpressionTree(c.restorePostfix()).renderParenthesized(c.source, out);
+        return out;
+    }
+    
+    Rendering& r = getRendering();
+    if (!r.hasParenthesized) {
+        ExpressionTree(c.postfix).renderParenthesized(c.source, r.parenthesized);
+        r.hasParenthesized = true;
+    }
+    return r.parenthesized;
 }
 
 string Expression::get_type() const {
-    return getStringType(type);
+    return getStringType(compiled->type);
 }
 
-/*
- * Function to compute the result of an expression given the variable table
- * Returns the integer result after a PEMDAS order of evaluation on the overall expression
- */
-int Expression::get_result(map<string, int>& variables) const {
-    if (getStringType(type) == "arithmetic") {
-        stack<int> operands;
-        int op1, op2;
-        for (Token t : postfix) {
-            if (t.get_type() == ID) {
-                operands.push(variables[t.get_token()]); // Push the corresponding value of the variable, not the variable itself
-            } else if (t.get_type() == INT) {
-                operands.push(stringToInt(t.get_token()));
-            } else if (t.get_type() == OP) {
-                op2 = operands.top();
-                operands.pop();
-                op1 = operands.top();
-                operands.pop();
-                
-                operands.push(evaluate(op1, op2, t.get_token()));
-            }
-        }
-        return operands.top();
-    }
-    return -1; //Never makes it here, main program won't call this function for non-arithmetic functions
+Exp_type Expression::get_exp_type() const {
+    return compiled->type;
+}
+
+// Why the expression is illegal, nullptr if it is not
+const char* Expression::get_error() const {
+    return compiled->error.message;
 }
 
 /*
- * Function to tokenize the expression for evaluation
+ * Offset into get_original() of the token the error was found at, or its length if it ended too early
+ * A form from a parse cache was parsed from the text with runs of spaces collapsed, so its position is mapped back.
  */
-void Expression::setTokens() {
-    // keeps track of what token we are currently making
-    // does not consider if the token is valid or not
-    bool inOrdinary = false;
-    
-    int tokstart = 0;
-    int toklength = 1;
-    
-    for (int i = 0; i < original.length(); i++) {
-        // have we found a special token?
-        if (isSpecialTok(original[i])) {
-            // if we are not already evaluating an INT or ID;
-            if (inOrdinary) {
-                // add ordinary token
-                tokenized.push_back(Token(original.substr(tokstart, toklength)));
-            }
-            // set variables correctly for special token
-            tokstart = i;
-            toklength = 1;
-            // add special token
-            tokenized.push_back(Token(original.substr(tokstart, toklength)));
-            // update helper variables
-            tokstart = i + 1;
-            toklength = 0;
-            inOrdinary = false;
-        }
-        else if (original[i] == ' ') {
-            if (inOrdinary) {
-                tokenized.push_back(Token(original.substr(tokstart, toklength)));
-            }
-            tokstart = i + 1;
-            toklength = 0;
-            inOrdinary = false;
-        }
-        // letter, number, or symbol
-        else {
-            if (!inOrdinary) {
-                tokstart = i;
-                toklength = 1;
-                inOrdinary = true;
-              // If we are already in an ordinary token, increment the token length
-            } else {
-                toklength++;
-            }
-        }
-        // Tokenizes the last token, if necessary
-        if (i == original.length() - 1 && toklength != 0) {
-            tokenized.push_back(Token(original.substr(tokstart, toklength)));
-        }
-    }
+size_t Expression::get_error_position() const {
+    return original.empty() ? compiled->error.position : originalOffset(original, compiled->error.position);
 }
 
-// Determines if the given expression is arithmetic, assignment, or invalid
-void Expression::setType() {
-    enum States {operand, func};
-    bool eqtrue = false; // set to true if = is encountered
-    States state = operand; // initial state value
-    int pcount = 0; // for checking braces
-    valid = true; // a field in Expression class
-    
-    for (Token t : tokenized) {
-        if (state == operand) {
-            if (t.get_type() == OpenBrace) {pcount++;}
-            else if (t.get_type() == INT || t.get_type() == ID) {state = func;}
-            else {valid = false; return;}
-        } else if (state == func) {
-            if (t.get_type() == CloseBrace) {
-                pcount--;
-                if (pcount < 0) {valid = false; return;}
-            } else if (t.get_type() == EQ) {
-                eqtrue = true;
-                state = operand;
-            } else if (t.get_type() == OP) {
-                state = operand;
-            } else {
-                valid = false;
-                return;
-            }
-        } else {
-            cout << "state is done and should not have reached this point!" << endl;
-        }
-    }
-    
-    if (pcount != 0) {valid = false; return;}
-    if (state == operand) {valid = false; return;}
-    if (eqtrue) {
-        if (tokenized.size() == 3 && tokenized[0].get_type() == ID && tokenized[2].get_type() == INT) {
-            type = assignment;
-        } else {
-            valid = false;
-        }
-    } else {
-        type = arithmetic;
-    }
+bool Expression::is_arithmetic() const {
+    return compiled->type == arithmetic;
 }
 
-// Function to arrange the tokens in postfix order for evaluation
-void Expression::setPostfix() {
-    if (type != arithmetic) {return;}
-    
-    stack<Token> ops;
-    
-    for (Token t : tokenized) {
-        if (t.get_type() == ID || t.get_type() == INT) {
-            postfix.push_back(t);
-        } else if (t.get_type() == OpenBrace) {
-            ops.push(t);
-        } else if (t.get_type() == CloseBrace) {
-            while (ops.size() != 0 && ops.top().get_type() != OpenBrace) {
-                postfix.push_back(ops.top());
-                ops.pop();
-            }
-            ops.pop(); // remove OpenBrace from stack 
-        } else { // Operator logic here
-            while (ops.size() != 0 && ops.top().get_priority() >= t.get_priority()) {
-                postfix.push_back(ops.top());
-                ops.pop();
-            }
-            ops.push(t);
-        }
-    }
-    // Flush ops stack after reaching the end of the expression
-    while (ops.size() != 0) {
-        postfix.push_back(ops.top());
-        ops.pop();
-    }  
+bool Expression::is_assignment() const {
+    return compiled->type == assignment;
 }
 
-// Function to arrange the tokens in prefix notation
-void Expression::setPrefix() {
-    if (type != arithmetic) {return;}
-    
-    stack<string> tmp;
-    string op1, op2;
-    
-    for (Token t : postfix) {
-        // Push operands to prefix immediately
-        if (t.get_type() == ID || t.get_type() == INT) {
-            tmp.push(t.get_token());
-        // Insert operators before top two operands    
-        } else {
-            op2 = tmp.top();
-            tmp.pop();
-            
-            op1 = tmp.top();
-            tmp.pop();
-            
-            tmp.push(t.get_token() + " " + op1 + " " + op2);
-        }
+// Symbol ids of the distinct variables an arithmetic expression reads
+const pmr::vector<int>& Expression::get_variables() const {
+    return compiled->program.get_variables();
+}
+
+// Number of bytecode instructions get_result runs, a measure of how expensive the expression is to evaluate
+size_t Expression::get_program_size() const {
+    return compiled->program.get_code().size();
+}
+
+const Program& Expression::get_program() const {
+    return compiled->program;
+}
+
+/*
+ * Function to compute the result of an expression given the variable table
+ * Returns the integer result after a PEMDAS order of evaluation on the overall expression
+ */
+int Expression::get_result(const SymbolTable& symbols) const {
+    if (compiled->type == arithmetic) {
+        STATS_PHASE(PHASE_EVALUATE);
+        return compiled->program.run(symbols.get_values());
     }
-    prefix = tmp.top();
+    return -1; //Never makes it here, main program won't call this function for non-arithmetic functions
 }
 
-// Function to add parentheses to the expression to indicate the order of operations under PEMDAS
-void Expression::setParenthesized() {
-    if (type != arithmetic) {return;}
-    
-    stack<string> tmp;
-    string op1;   // operand 1
-    string op2;   // operand 2
-    for (Token t : postfix) {
-        if (t.get_type() == ID || t.get_type() == INT) {
-            tmp.push(t.get_token());
-        } else if (t.get_type() == OP) {
-            op2 = tmp.top();
-            tmp.pop();
-            
-            op1 = tmp.top();
-            tmp.pop();
-            
-            tmp.push("(" + op1 + t.get_token() + op2 + ")");
-        }               
+/*
+ * Same as get_result under arithmetic policy A, overflow and division by zero come back as a status where A reports them
+ * Returns EVAL_NOT_ARITHMETIC without running anything for an assignment or an illegal or empty expression.
+ */
+template <class A>
+EvalStatus Expression::get_result_as(const SymbolTable& symbols, typename A::value_type& result) const {
+    if (compiled->type != arithmetic) {return EVAL_NOT_ARITHMETIC;}
+    STATS_PHASE(PHASE_EVALUATE);
+    return compiled->program.run_as<A>(symbols.get_values(), result);
+}
+
+template EvalStatus Expression::get_result_as<Int32Arithmetic>(const SymbolTable&, int32_t&) const;
+template EvalStatus Expression::get_result_as<Int64Arithmetic>(const SymbolTable&, int64_t&) const;
+template EvalStatus Expression::get_result_as<CheckedInt32Arithmetic>(const SymbolTable&, int32_t&) const;
+template EvalStatus Expression::get_result_as<DoubleArithmetic>(const SymbolTable&, double&) const;
+
+/*
+ * Function to compute the result for many rows at once, variables bound to a column take their value from row r
+ * out[r] gets the result for row r, see evaluateColumns for the rows that fail and status. Nothing is written and
+ * EVAL_NOT_ARITHMETIC or EVAL_UNDEFINED is returned if the expression is not arithmetic or one of its variables is
+ * neither bound nor defined, even one folding took out of the program.
+ */
+EvalStatus Expression::get_results(const ColumnBindings& bindings, size_t rows, int32_t* out, EvalStatus* status) const {
+    if (compiled->type != arithmetic) {return EVAL_NOT_ARITHMETIC;}
+    const pmr::vector<int>& variables = get_variables();
+    for (size_t v = 0; v < variables.size(); v++) {
+        if (!bindings.is_available(variables[v])) {return EVAL_UNDEFINED;}
     }
-    parenthesized = tmp.top();
+    return evaluateColumns(compiled->program, bindings, rows, out, status);
 }
 
+// Copies share the compiled form, unless it lives in an arena that could be released before the copy is gone
 Expression& Expression::operator=(const Expression& e) {
+    if (this == &e) {return *this;}
     original = e.original;
-    tokenized = e.tokenized;
-    postfix = e.postfix;
-    prefix = e.prefix;
-    parenthesized = e.parenthesized;
-    valid = e.valid;
-    type = e.type;
+    if (e.compiled->source.get_allocator().resource() == pmr::get_default_resource()) {
+        compiled = e.compiled;
+    } else {
+        compiled = make_shared<CompiledExpression>(*e.compiled); // the copy's storage comes from the default resource
+    }
+    rendered.reset(e.rendered ? new Rendering(*e.rendered) : nullptr);
     
     return *this;
-}
\ No newline at end of file
+}
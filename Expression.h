@@ -7,43 +7,101 @@
 #ifndef EXPRESSION_H
 #define EXPRESSION_H
 #include <string>
+#include <string_view>
 #include <vector>
+#include <memory_resource>
 #include <sstream>
-#include <map>
+#include <memory>
 #include "Token.h"
+#include "Program.h"
 
 using namespace std;
 
 enum Exp_type {assignment, arithmetic, illegal};
 
+// Why and where an expression was rejected
+struct ParseError {
+    const char* message;  // nullptr if the expression is valid
+    size_t position;      // offset of the rejected token in the parsed source, its length if the source ended too early
+};
+
+class ColumnBindings;
+class ParseCache;
+
+/*
+ * Everything that is derived from the source text of an expression
+ * Expressions with the same text share one form through a ParseCache, so a form does not change once an expression holds it.
+ * All of its storage comes from one memory resource, which lets a session keep its forms in an arena.
+ */
+struct CompiledExpression {
+    pmr::string source; // text the tokens are spans into
+    pmr::vector<Token> tokenized;
+    pmr::vector<Token> postfix;
+    Program program; // postfix compiled once for get_result
+    bool valid;
+    bool compacted; // tokenized and postfix were dropped and are re-derived from source when needed
+    Exp_type type;
+    ParseError error; // not kept in snapshots, a form loaded from one parses its source again to find it
+    
+    CompiledExpression(pmr::memory_resource* resource = pmr::get_default_resource());
+    CompiledExpression(const CompiledExpression& c) = default;
+    void parse(SymbolTable& symbols);
+    pmr::vector<Token> restorePostfix() const;
+    size_t get_memory() const;
+};
+
 class Expression {
 public:
     Expression();
-    Expression(const string& s);
-    void set(const string& s);
+    Expression(const string& s, SymbolTable& symbols);
+    Expression(const string& s, SymbolTable& symbols, ParseCache& cache);
+    Expression(const string& s, SymbolTable& symbols, pmr::memory_resource* resource);
+    Expression(string_view s, const shared_ptr<const CompiledExpression>& form);
+    Expression(const Expression& e);
+    Expression(Expression&& e) = default;
+    void set(const string& s, SymbolTable& symbols);
+    void set(const string& s, SymbolTable& symbols, ParseCache& cache);
+    void set(const string& s, SymbolTable& symbols, pmr::memory_resource* resource);
+    void compact();
+    bool is_compact() const;
+    void remap_variables(const vector<int>& ids);
     void display() const;
-    string get_original() const;
-    vector<Token> get_tokenized() const;
-    vector<Token> get_postfix() const;
+    string_view get_original() const;
+    string_view get_source() const;                  // what the tokens are spans into, see ParseCache
+    const pmr::vector<Token>& get_tokenized() const; // empty once compacted
+    const pmr::vector<Token>& get_postfix() const;   // empty once compacted
+    string get_postfix_string() const;
     string get_prefix() const;
     string get_parenthesized() const;
     string get_type() const;
-    int get_result(map<string, int>& variables) const;
+    const char* get_error() const;
+    size_t get_error_position() const;
+    Exp_type get_exp_type() const;
+    bool is_arithmetic() const;
+    bool is_assignment() const;
+    const pmr::vector<int>& get_variables() const;
+    size_t get_program_size() const;
+    const Program& get_program() const;
+    int get_result(const SymbolTable& symbols) const;
+    template <class A> EvalStatus get_result_as(const SymbolTable& symbols, typename A::value_type& result) const;
+    EvalStatus get_results(const ColumnBindings& bindings, size_t rows, int32_t* out, EvalStatus* status = nullptr) const;
     Expression& operator=(const Expression& e);
+    Expression& operator=(Expression&& e) = default;
 private:
-    string original;
-    vector<Token> tokenized;
-    vector<Token> postfix;
-    string prefix;
-    string parenthesized;
-    bool valid;
-    Exp_type type;
+    string original; // empty when it is the same as compiled->source
+    shared_ptr<const CompiledExpression> compiled;
+    
+    // prefix and parenthesized forms are only built the first time they are asked for
+    struct Rendering {
+        string prefix;
+        string parenthesized;
+        bool hasPrefix;
+        bool hasParenthesized;
+    };
+    mutable unique_ptr<Rendering> rendered;
     
     // Helper functions
-    void setTokens();
-    void setType();
-    void setPostfix();
-    void setPrefix();
-    void setParenthesized();
+    CompiledExpression& ownForm();
+    Rendering& getRendering() const;
 };
 #endif /* EXPRESSION_H */
\ No newline at end of file
@@ -0,0 +1,252 @@
+/* 
+ * File:   ExpressionDag.cpp
+ * Author: John Shelnutt
+ * Synopsis: Implements the shared subexpression graph - hash-consing the programs of a sequence into one graph and evaluating its nodes once each, in topological order
+ */
+
+#include "ExpressionDag.h"
+#include "Stats.h"
+#include <climits>
+using namespace std;
+
+const uint32_t NO_NODE = UINT32_MAX;
+
+// Node flags
+const unsigned char DEFINED = 1;  // every variable the node reads is defined, set by each evaluate
+const unsigned char NEEDED = 2;   // an expression that can be evaluated reads the node, set by each evaluate
+const unsigned char VALID = 4;    // the value is up to date
+const unsigned char CHANGED = 8;  // the value may differ from the one the nodes above last used, set by each evaluate
+const unsigned char PENDING = 16; // a variable leaf that changed since the last evaluate
+
+// The value of a node as the type of a policy
+inline void storeValue(int32_t x, int64_t& integer, double&) {integer = x;}
+inline void storeValue(int64_t x, int64_t& integer, double&) {integer = x;}
+inline void storeValue(double x, int64_t&, double& real) {real = x;}
+inline void loadValue(int32_t& x, int64_t integer, double) {x = (int32_t)integer;}
+inline void loadValue(int64_t& x, int64_t integer, double) {x = integer;}
+inline void loadValue(double& x, int64_t, double real) {x = real;}
+
+ExpressionDag::ExpressionDag(pmr::memory_resource* resource) : resource(resource), nodes(resource), index(resource),
+                                                               roots(resource), values(resource), status(resource),
+                                                               flags(resource), stack(resource), unread(resource),
+                                                               defined(resource) {
+    instructions = 0;
+    operations = 0;
+    reshaped = false;
+}
+
+// The node equal to n, appended if there is none yet
+uint32_t ExpressionDag::intern(const Node& n) {
+    pair<pmr::unordered_map<Node, uint32_t, NodeHash>::iterator, bool> found = index.emplace(n, (uint32_t)nodes.size());
+    if (found.second) {
+        nodes.push_back(n);
+        values.push_back(Value());
+        status.push_back(EVAL_OK);
+        flags.push_back(0);
+    }
+    return found.first->second;
+}
+
+/*
+ * Function to append the next expression of the sequence
+ * Its program is replayed on a stack of nodes: literals and variables push their node, operators pop two and push the
+ * node applying them. Only the nodes no earlier expression had are new. Variables of e that folding dropped from the
+ * program, as in (x%1)*y, still get a leaf, which e needs defined without reading it.
+ */
+void ExpressionDag::add(const Expression& e) {
+    defined.push_back(0);
+    if (!e.is_arithmetic()) {
+        roots.push_back(NO_NODE);
+        return;
+    }
+    reshaped = true; // even without new nodes, the root of e may not be needed yet
+    const pmr::vector<Instruction>& code = e.get_program().get_code();
+    instructions += code.size();
+    stack.clear();
+    for (const Instruction& in : code) {
+        Node n = {in.op, 0, 0, 0};
+        if (in.op == PUSH_CONST || in.op == LOAD_SLOT) {
+            n.operand = in.operand;
+        } else {
+            n.right = stack.back();
+            stack.pop_back();
+            n.left = stack.back();
+            stack.pop_back();
+        }
+        stack.push_back(intern(n));
+    }
+    roots.push_back(stack.back());
+    
+    const pmr::vector<int>& variables = e.get_variables();
+    for (size_t v = 0; v < variables.size(); v++) {
+        bool read = false;
+        for (size_t i = 0; !read && i < code.size(); i++) {
+            read = code[i].op == LOAD_SLOT && code[i].operand == variables[v];
+        }
+        if (!read) {
+            Node n = {LOAD_SLOT, variables[v], 0, 0};
+            unread.push_back(make_pair(roots.size() - 1, intern(n)));
+        }
+    }
+}
+
+// Drops every node, the storage is handed back to the resource before it is released
+void ExpressionDag::clear() {
+    nodes = pmr::vector<Node>(resource);
+    index = pmr::unordered_map<Node, uint32_t, NodeHash>(resource);
+    roots = pmr::vector<uint32_t>(resource);
+    values = pmr::vector<Value>(resource);
+    status = pmr::vector<unsigned char>(resource);
+    flags = pmr::vector<unsigned char>(resource);
+    stack = pmr::vector<uint32_t>(resource);
+    unread = pmr::vector<pair<size_t, uint32_t> >(resource);
+    defined = pmr::vector<char>(resource);
+    instructions = 0;
+    operations = 0;
+    reshaped = false;
+}
+
+// The value of variable id changed or it became defined, the nodes reading it are recomputed by the next evaluate
+void ExpressionDag::variableChanged(int id) {
+    Node n = {LOAD_SLOT, id, 0, 0};
+    pmr::unordered_map<Node, uint32_t, NodeHash>::const_iterator found = index.find(n);
+    if (found != index.end()) {
+        unsigned char& f = flags[found->second];
+        if (!(f & DEFINED)) {reshaped = true;}
+        f = (f & ~VALID) | PENDING;
+    }
+}
+
+// Forgets every value, for a different policy or a symbol table the changes of which were not reported
+void ExpressionDag::invalidate() {
+    for (unsigned char& f : flags) {
+        f &= ~VALID;
+    }
+    reshaped = true;
+}
+
+/*
+ * Function to bring the values every evaluable expression needs up to date under arithmetic policy A
+ * Three passes over the nodes: which are defined (operands first), which are needed (from the roots down), and computing
+ * the needed ones that are not valid (operands first again). The first two are skipped while no expression was added
+ * and no variable became defined. A node whose operand changed is not valid any more, whether it is needed now or not.
+ * Errors are passed up: the left operand's first, then the right one's, then the node's own, which is the order the
+ * program would have run into them.
+ */
+template <class A>
+void ExpressionDag::evaluate(const SymbolTable& symbols) {
+    STATS_PHASE(PHASE_EVALUATE);
+    typedef typename A::value_type T;
+    size_t count = nodes.size();
+    for (size_t i = 0; reshaped && i < count; i++) {
+        const Node& n = nodes[i];
+        bool defined = true;
+        if (n.op == LOAD_SLOT) {
+            defined = symbols.is_defined(n.operand);
+        } else if (n.op != PUSH_CONST) {
+            defined = (flags[n.left] & flags[n.right] & DEFINED) != 0;
+        }
+        flags[i] = (flags[i] & ~(DEFINED | NEEDED)) | (defined ? DEFINED : 0);
+    }
+    if (reshaped) {
+        for (size_t e = 0; e < roots.size(); e++) {
+            defined[e] = roots[e] != NO_NODE && (flags[roots[e]] & DEFINED);
+        }
+        for (const pair<size_t, uint32_t>& u : unread) {
+            defined[u.first] = defined[u.first] && (flags[u.second] & DEFINED);
+        }
+        for (size_t e = 0; e < roots.size(); e++) {
+            if (defined[e]) {
+                flags[roots[e]] |= NEEDED;
+            }
+        }
+        for (size_t i = count; i-- > 0;) {
+            const Node& n = nodes[i];
+            if ((flags[i] & NEEDED) && n.op != PUSH_CONST && n.op != LOAD_SLOT) {
+                flags[n.left] |= NEEDED;
+                flags[n.right] |= NEEDED;
+            }
+        }
+        reshaped = false;
+    }
+    
+    const int* variables = symbols.get_values();
+    operations = 0;
+    for (size_t i = 0; i < count; i++) {
+        const Node& n = nodes[i];
+        bool leaf = n.op == PUSH_CONST || n.op == LOAD_SLOT;
+        unsigned char f = flags[i] & ~PENDING;
+        bool changed = (flags[i] & PENDING) != 0;
+        if (!leaf && ((flags[n.left] | flags[n.right]) & CHANGED)) {
+            changed = true;
+            f &= ~VALID;
+        }
+        if ((f & NEEDED) && !(f & VALID)) {
+            T result = 0;
+            EvalStatus s = EVAL_OK;
+            if (n.op == PUSH_CONST) {
+                result = n.operand;
+            } else if (n.op == LOAD_SLOT) {
+                result = variables[n.operand];
+            } else if (status[n.left] != EVAL_OK) {
+                s = (EvalStatus)status[n.left];
+            } else if (status[n.right] != EVAL_OK) {
+                s = (EvalStatus)status[n.right];
+            } else {
+                T a, b;
+                loadValue(a, values[n.left].integer, values[n.left].real);
+                loadValue(b, values[n.right].integer, values[n.right].real);
+                s = applyOperator<A>(n.op, a, b, result);
+                operations++;
+            }
+            storeValue(result, values[i].integer, values[i].real);
+            status[i] = s;
+            f |= VALID;
+            changed = true;
+        }
+        flags[i] = changed ? f | CHANGED : f & ~CHANGED; // operands come first, so this pass has set theirs already
+    }
+}
+
+template void ExpressionDag::evaluate<Int32Arithmetic>(const SymbolTable&);
+template void ExpressionDag::evaluate<Int64Arithmetic>(const SymbolTable&);
+template void ExpressionDag::evaluate<CheckedInt32Arithmetic>(const SymbolTable&);
+template void ExpressionDag::evaluate<DoubleArithmetic>(const SymbolTable&);
+
+// Whether expression index is arithmetic with every variable defined, as of the last evaluate
+bool ExpressionDag::is_defined(size_t index) const {
+    return defined[index] != 0;
+}
+
+// Result of expression index under the policy of the last evaluate, which has to be defined; value is only set if it is ok
+template <class A>
+EvalStatus ExpressionDag::get_result(size_t index, typename A::value_type& value) const {
+    uint32_t root = roots[index];
+    if (status[root] == EVAL_OK) {
+        loadValue(value, values[root].integer, values[root].real);
+    }
+    return (EvalStatus)status[root];
+}
+
+template EvalStatus ExpressionDag::get_result<Int32Arithmetic>(size_t, int32_t&) const;
+template EvalStatus ExpressionDag::get_result<Int64Arithmetic>(size_t, int64_t&) const;
+template EvalStatus ExpressionDag::get_result<CheckedInt32Arithmetic>(size_t, int32_t&) const;
+template EvalStatus ExpressionDag::get_result<DoubleArithmetic>(size_t, double&) const;
+
+// Expressions added so far
+size_t ExpressionDag::size() const {
+    return roots.size();
+}
+
+size_t ExpressionDag::get_node_count() const {
+    return nodes.size();
+}
+
+size_t ExpressionDag::get_instruction_count() const {
+    return instructions;
+}
+
+// Operators applied by the last evaluate, against one per operator instruction when every expression runs on its own
+size_t ExpressionDag::get_operations() const {
+    return operations;
+}
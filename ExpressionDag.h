@@ -0,0 +1,88 @@
+/* 
+ * File:   ExpressionDag.h
+ * Author: John Shelnutt
+ * Synopsis: Header file for the shared subexpression graph - every subtree of every expression in a sequence stored once, so the = action evaluates each distinct subexpression once
+ */
+
+#ifndef EXPRESSIONDAG_H
+#define EXPRESSIONDAG_H
+
+#include <vector>
+#include <unordered_map>
+#include <memory_resource>
+#include <cstdint>
+#include "Expression.h"
+#include "SymbolTable.h"
+#include "Program.h"
+using namespace std;
+
+/*
+ * Directed acyclic graph of the compiled programs of a sequence, hash-consed: a literal, a variable or an operator applied
+ * to the same two nodes is always the same node, whichever expression it came from
+ * Nodes are only ever appended and always after their operands, so their order is a topological order. Every expression
+ * points at the node of its result. evaluate only computes the nodes that an expression with all of its variables defined
+ * needs, and keeps their values until a variable they read changes, so a sequence that repeats a subexpression thousands
+ * of times computes it once.
+ * Operands are matched as written: a*b and b*a are two nodes, so errors are still reported in the order the program would.
+ * This is not free: every = also walks the graph's flags, and a node costs more to compute than an instruction of a
+ * program. It wins when many expressions repeat costly subexpressions and computing them dominates printing. When
+ * little repeats or printing dominates, as in calculator_bench's printResult_redundant scenarios, it is no faster and
+ * can be a few percent slower (medium measured 114 us shared against 107 us).
+ */
+class ExpressionDag {
+public:
+    ExpressionDag(pmr::memory_resource* resource = pmr::get_default_resource());
+    void add(const Expression& e);
+    void clear();
+    void variableChanged(int id);
+    void invalidate();
+    template <class A> void evaluate(const SymbolTable& symbols);
+    bool is_defined(size_t index) const;
+    template <class A> EvalStatus get_result(size_t index, typename A::value_type& value) const;
+    size_t size() const;
+    size_t get_node_count() const;
+    size_t get_instruction_count() const;
+    size_t get_operations() const;
+private:
+    struct Node {
+        Opcode op;
+        int operand;    // literal for PUSH_CONST, symbol id for LOAD_SLOT, 0 for operators
+        uint32_t left;  // operands of an operator, 0 for the leaves
+        uint32_t right;
+    
+        bool operator==(const Node& n) const {return op == n.op && operand == n.operand && left == n.left && right == n.right;}
+    };
+    
+    struct NodeHash {
+        size_t operator()(const Node& n) const {
+            uint64_t h = ((uint64_t)n.left << 32 | n.right) * 0x9E3779B97F4A7C15ULL;
+            h ^= ((uint64_t)(uint32_t)n.operand << 8 | n.op) + (h >> 29);
+            return (size_t)(h * 0xBF58476D1CE4E5B9ULL);
+        }
+    };
+    
+    // The value of a node under whichever policy evaluated it last, the integer policies use integer
+    struct Value {
+        int64_t integer;
+        double real;
+    };
+    
+    pmr::memory_resource* resource;
+    pmr::vector<Node> nodes;
+    pmr::unordered_map<Node, uint32_t, NodeHash> index;  // every node, for hash-consing
+    pmr::vector<uint32_t> roots;      // result node of every expression added, NO_NODE if it is not arithmetic
+    pmr::vector<Value> values;
+    pmr::vector<unsigned char> status; // EvalStatus of every node with a value
+    pmr::vector<unsigned char> flags;  // see ExpressionDag.cpp
+    pmr::vector<uint32_t> stack;       // operands while a program is added, kept to not allocate per expression
+    pmr::vector<pair<size_t, uint32_t> > unread; // expression and leaf of every variable folded out of its program
+    pmr::vector<char> defined;         // of every expression added, as of the last evaluate
+    size_t instructions;  // of every program added
+    size_t operations;    // nodes computed by the last evaluate
+    bool reshaped;        // expressions were added or a variable became defined, so which are defined and needed may differ
+    
+    // Helper functions
+    uint32_t intern(const Node& n);
+};
+
+#endif /* EXPRESSIONDAG_H */
@@ -0,0 +1,102 @@
+/* 
+ * File:   ExpressionTree.cpp
+ * Author: John Shelnutt
+ * Synopsis: Builds an expression tree from postfix tokens and renders it without recursion or intermediate strings, so output is O(n) even for very long or deeply nested expressions
+ */
+
+#include "ExpressionTree.h"
+using namespace std;
+
+// Builds the tree in one pass over the postfix tokens, operands are linked to their operator through a stack of node indices
+ExpressionTree::ExpressionTree(const pmr::vector<Token>& postfix) {
+    nodes.reserve(postfix.size());
+    vector<int> operands;
+    
+    for (size_t i = 0; i < postfix.size(); i++) {
+        Node n;
+        n.token = postfix[i];
+        n.left = -1;
+        n.right = -1;
+        if (n.token.get_type() == OP) {
+            n.right = operands.back();
+            operands.pop_back();
+            n.left = operands.back();
+            operands.pop_back();
+        }
+        operands.push_back((int)nodes.size());
+        nodes.push_back(n);
+    }
+}
+
+size_t ExpressionTree::size() const {
+    return nodes.size();
+}
+
+// Total characters of all tokens, used to reserve the output once
+size_t ExpressionTree::textLength() const {
+    size_t length = 0;
+    for (size_t i = 0; i < nodes.size(); i++) {
+        length += nodes[i].token.get_length();
+    }
+    return length;
+}
+
+// Appends "op left right" with single spaces between tokens
+void ExpressionTree::renderPrefix(string_view source, string& out) const {
+    if (nodes.empty()) {return;}
+    out.reserve(out.size() + textLength() + nodes.size());
+    
+    vector<int> pending(1, (int)nodes.size() - 1);
+    bool first = true;
+    while (!pending.empty()) {
+        const Node& n = nodes[pending.back()];
+        pending.pop_back();
+        
+        if (!first) {out += ' ';}
+        first = false;
+        out.append(source, n.token.get_offset(), n.token.get_length());
+        
+        if (n.left != -1) {
+            pending.push_back(n.right);
+            pending.push_back(n.left);
+        }
+    }
+}
+
+// Appends the tokens in evaluation order separated by single spaces - the node array is already in that order
+void ExpressionTree::renderPostfix(string_view source, string& out) const {
+    out.reserve(out.size() + textLength() + nodes.size());
+    for (size_t i = 0; i < nodes.size(); i++) {
+        if (i != 0) {out += ' ';}
+        out.append(source, nodes[i].token.get_offset(), nodes[i].token.get_length());
+    }
+}
+
+// Appends "(left op right)" for every operator
+void ExpressionTree::renderParenthesized(string_view source, string& out) const {
+    if (nodes.empty()) {return;}
+    out.reserve(out.size() + textLength() + nodes.size());
+    
+    // Each entry is a node index and how far along that node is: 0 = not started, 1 = left done, 2 = right done
+    vector<pair<int, int> > pending(1, pair<int, int>((int)nodes.size() - 1, 0));
+    while (!pending.empty()) {
+        pair<int, int>& top = pending.back();
+        const Node& n = nodes[top.first];
+        
+        if (n.left == -1) {
+            out.append(source, n.token.get_offset(), n.token.get_length());
+            pending.pop_back();
+        } else if (top.second == 0) {
+            out += '(';
+            top.second = 1;
+            pending.push_back(pair<int, int>(n.left, 0));
+        } else if (top.second == 1) {
+            out.append(source, n.token.get_offset(), n.token.get_length());
+            top.second = 2;
+            pending.push_back(pair<int, int>(n.right, 0));
+        } else {
+            out += ')';
+            pending.pop_back();
+        }
+    }
+}
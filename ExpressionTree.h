@@ -0,0 +1,35 @@
+/* 
+ * File:   ExpressionTree.h
+ * Author: John Shelnutt
+ * Synopsis: Header file for the explicit tree of an arithmetic expression, used to write its prefix, postfix and fully parenthesized forms in one linear traversal
+ */
+
+#ifndef EXPRESSIONTREE_H
+#define EXPRESSIONTREE_H
+
+#include <string>
+#include <vector>
+#include <memory_resource>
+#include "Token.h"
+using namespace std;
+
+class ExpressionTree {
+public:
+    ExpressionTree(const pmr::vector<Token>& postfix);
+    void renderPrefix(string_view source, string& out) const;
+    void renderPostfix(string_view source, string& out) const;
+    void renderParenthesized(string_view source, string& out) const;
+    size_t size() const;
+private:
+    struct Node {
+        Token token;
+        int left;  // -1 for operands
+        int right;
+    };
+    vector<Node> nodes; // stored in postfix order, so children always come before their parent and the root is last
+    
+    // Helper functions
+    size_t textLength() const;
+};
+
+#endif /* EXPRESSIONTREE_H */
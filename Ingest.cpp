@@ -0,0 +1,112 @@
+/* 
+ * File:   Ingest.cpp
+ * Author: John Shelnutt
+ * Synopsis: Memory maps expression files and finds the expression boundaries of every chunk of the file on its own thread
+ */
+
+#include "Ingest.h"
+#include "Scan.h"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+using namespace std;
+
+MappedFile::MappedFile() {
+    memory = nullptr;
+    length = 0;
+}
+
+MappedFile::~MappedFile() {
+    if (memory) {
+        munmap(memory, length);
+    }
+}
+
+// Maps the whole file read-only, returns false if it cannot be opened or mapped
+bool MappedFile::open(const string& path) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {return false;}
+    
+    struct stat info;
+    if (fstat(fd, &info) != 0) {
+        close(fd);
+        return false;
+    }
+    length = (size_t)info.st_size;
+    if (length == 0) {
+        close(fd);
+        return true;
+    }
+    
+    memory = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (memory == MAP_FAILED) {
+        memory = nullptr;
+        length = 0;
+        return false;
+    }
+    madvise(memory, length, MADV_SEQUENTIAL);
+    return true;
+}
+
+const char* MappedFile::data() const {
+    return (const char*)memory;
+}
+
+size_t MappedFile::size() const {
+    return length;
+}
+
+// Bytes of the file each boundary-scanning task covers
+const size_t SCAN_CHUNK = 1 << 20;
+
+inline bool isSeparator(char c) {
+    return c == ';' || c == '\n';
+}
+
+/*
+ * Function to find every expression in the file
+ * Expressions are separated by ; or line breaks (\n or \r\n), and empty ones are skipped. Every task scans its own byte range,
+ * and an expression belongs to the task its first character falls in.
+ */
+void splitExpressions(const char* data, size_t size, ThreadPool& pool, vector<Span>& spans) {
+    size_t chunks = (size + SCAN_CHUNK - 1) / SCAN_CHUNK;
+    vector<vector<Span> > found(chunks);
+    
+    pool.run(chunks, [&](size_t c) {
+        size_t begin = c * SCAN_CHUNK;
+        size_t end = begin + SCAN_CHUNK < size ? begin + SCAN_CHUNK : size;
+        size_t i = begin;
+        
+        // An expression that started in the previous chunk is finished by that chunk's task
+        if (i != 0 && !isSeparator(data[i - 1])) {
+            i = findSeparator(data, i, end);
+        }
+        while (i < end) {
+            if (isSeparator(data[i])) {
+                i++;
+                continue;
+            }
+            // the last expression of a chunk may run past its end
+            size_t stop = findSeparator(data, i, size);
+            
+            size_t length = stop - i;
+            if (data[stop - 1] == '\r') {length--;}
+            if (length != 0) {
+                Span s = {i, length};
+                found[c].push_back(s);
+            }
+            i = stop;
+        }
+    });
+    
+    size_t total = spans.size();
+    for (size_t c = 0; c < chunks; c++) {
+        total += found[c].size();
+    }
+    spans.reserve(total);
+    for (size_t c = 0; c < chunks; c++) {
+        spans.insert(spans.end(), found[c].begin(), found[c].end());
+    }
+}
@@ -0,0 +1,37 @@
+/* 
+ * File:   Ingest.h
+ * Author: John Shelnutt
+ * Synopsis: Header file for loading large expression files - the file is memory mapped and split into expressions in parallel
+ */
+
+#ifndef INGEST_H
+#define INGEST_H
+
+#include <string>
+#include <vector>
+#include "ThreadPool.h"
+using namespace std;
+
+class MappedFile {
+public:
+    MappedFile();
+    ~MappedFile();
+    bool open(const string& path);
+    const char* data() const;
+    size_t size() const;
+private:
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    
+    void* memory;
+    size_t length;
+};
+
+struct Span {
+    size_t start;
+    size_t length;
+};
+
+void splitExpressions(const char* data, size_t size, ThreadPool& pool, vector<Span>& spans);
+
+#endif /* INGEST_H */
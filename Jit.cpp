@@ -0,0 +1,256 @@
+/* 
+ * File:   Jit.cpp
+ * Author: John Shelnutt
+ * Synopsis: x86-64 code generator for compiled programs. The top of the operand stack lives in eax and the rest on the machine stack;
+ *           variables become [rdi + 4*id] memory operands and literals become immediates. Division and modulo use idiv, which is
+ *           exactly what the interpreter's / and % compile to, so they trap in the same cases.
+ */
+
+#include "Jit.h"
+#include "Program.h"
+#include <cstring>
+#include <cstdint>
+#include <mutex>
+#if defined(CALCULATOR_JIT) && defined(__x86_64__) && defined(__linux__)
+#include <sys/mman.h>
+#include <unistd.h>
+#define JIT_SUPPORTED 1
+#endif
+using namespace std;
+
+#ifdef JIT_SUPPORTED
+
+// Machine code is appended to a plain byte vector and copied into an executable mapping at the end
+class Emitter {
+public:
+    vector<unsigned char> bytes;
+    
+    void byte(unsigned char b) {
+        bytes.push_back(b);
+    }
+    void bytes2(unsigned char a, unsigned char b) {
+        byte(a);
+        byte(b);
+    }
+    void imm32(int v) {
+        uint32_t u = (uint32_t)v;
+        for (int i = 0; i < 4; i++) {
+            byte((unsigned char)(u >> (8 * i)));
+        }
+    }
+    // disp32 of [rdi + 4*id]
+    void slot(int id) {
+        imm32(id * 4);
+    }
+    
+    // eax = operand
+    void load(const Instruction& instr) {
+        if (instr.op == PUSH_CONST) {
+            byte(0xB8);                 // mov eax, imm32
+            imm32(instr.operand);
+        } else {
+            bytes2(0x8B, 0x87);         // mov eax, [rdi + disp32]
+            slot(instr.operand);
+        }
+    }
+    
+    // ecx = operand
+    void loadEcx(const Instruction& instr) {
+        if (instr.op == PUSH_CONST) {
+            byte(0xB9);                 // mov ecx, imm32
+            imm32(instr.operand);
+        } else {
+            bytes2(0x8B, 0x8F);         // mov ecx, [rdi + disp32]
+            slot(instr.operand);
+        }
+    }
+    
+    // eax = eax op ecx
+    void opEcx(Opcode op) {
+        switch (op) {
+            case ADD:
+                bytes2(0x01, 0xC8);     // add eax, ecx
+                break;
+            case SUB:
+                bytes2(0x29, 0xC8);     // sub eax, ecx
+                break;
+            case MUL:
+                bytes2(0x0F, 0xAF);     // imul eax, ecx
+                byte(0xC1);
+                break;
+            case DIV:
+                byte(0x99);             // cdq
+                bytes2(0xF7, 0xF9);     // idiv ecx
+                break;
+            default:
+                byte(0x99);             // cdq
+                bytes2(0xF7, 0xF9);     // idiv ecx
+                bytes2(0x89, 0xD0);     // mov eax, edx
+                break;
+        }
+    }
+    
+    // eax = eax op operand, using the operand directly as an immediate or memory operand where x86 allows it
+    void opOperand(Opcode op, const Instruction& instr) {
+        bool constant = instr.op == PUSH_CONST;
+        if (op == ADD) {
+            if (constant) {byte(0x05); imm32(instr.operand);}                  // add eax, imm32
+            else {bytes2(0x03, 0x87); slot(instr.operand);}                   // add eax, [rdi + disp32]
+        } else if (op == SUB) {
+            if (constant) {byte(0x2D); imm32(instr.operand);}                  // sub eax, imm32
+            else {bytes2(0x2B, 0x87); slot(instr.operand);}                   // sub eax, [rdi + disp32]
+        } else if (op == MUL) {
+            if (constant) {bytes2(0x69, 0xC0); imm32(instr.operand);}          // imul eax, eax, imm32
+            else {bytes2(0x0F, 0xAF); byte(0x87); slot(instr.operand);}       // imul eax, [rdi + disp32]
+        } else {
+            loadEcx(instr);
+            opEcx(op);
+        }
+    }
+};
+
+/*
+ * Function to generate machine code for int f(const int* values)
+ * An operand that is immediately consumed by an operator is folded into that operator instead of being pushed
+ */
+bool generate(const pmr::vector<Instruction>& code, Emitter& e) {
+    int depth = 0; // values on the operand stack, the top one is in eax
+    for (size_t i = 0; i < code.size(); i++) {
+        const Instruction& instr = code[i];
+        if (instr.op == PUSH_CONST || instr.op == LOAD_SLOT) {
+            if (depth > 0 && i + 1 < code.size() && code[i + 1].op != PUSH_CONST && code[i + 1].op != LOAD_SLOT) {
+                e.opOperand(code[i + 1].op, instr);
+                i++;
+                continue;
+            }
+            if (depth > 0) {
+                e.byte(0x50);               // push rax
+            }
+            e.load(instr);
+            if (++depth > JIT_MAX_DEPTH) {return false;}
+        } else {
+            if (depth < 2) {return false;}
+            e.bytes2(0x89, 0xC1);           // mov ecx, eax
+            e.byte(0x58);                   // pop rax
+            e.opEcx(instr.op);
+            depth--;
+        }
+    }
+    if (depth != 1) {return false;}
+    e.byte(0xC3);                           // ret
+    return true;
+}
+
+const size_t JIT_CHUNK_SIZE = 1 << 20;
+const size_t JIT_ALIGNMENT = 16;
+
+#endif
+
+/*
+ * Executable memory mapped twice from one memfd: code is written through the writable view and run through the
+ * executable one, so no page is ever writable and executable at once, and writing a function never touches the
+ * permissions of the ones already running from the same chunk
+ */
+struct JitChunk {
+    unsigned char* writable;
+    unsigned char* executable;
+    size_t size;
+    size_t used;   // bytes handed out, functions are never moved or reused
+    size_t live;   // functions placed in the chunk and not destroyed yet
+};
+
+#ifdef JIT_SUPPORTED
+
+// The chunk new code goes to, shared by every thread. Never destroyed, functions may outlive static destructors.
+struct JitArena {
+    mutex lock;    // current and the live count of every chunk
+    JitChunk* current;
+};
+
+JitArena& jitArena() {
+    static JitArena* arena = new JitArena{{}, nullptr};
+    return *arena;
+}
+
+JitChunk* mapChunk(size_t size) {
+    int fd = memfd_create("calculator-jit", MFD_CLOEXEC);
+    if (fd < 0) {return nullptr;}
+    JitChunk* chunk = nullptr;
+    if (ftruncate(fd, (off_t)size) == 0) {
+        void* writable = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        void* executable = mmap(nullptr, size, PROT_READ | PROT_EXEC, MAP_SHARED, fd, 0);
+        if (writable != MAP_FAILED && executable != MAP_FAILED) {
+            chunk = new JitChunk{(unsigned char*)writable, (unsigned char*)executable, size, 0, 0};
+        } else {
+            if (writable != MAP_FAILED) {munmap(writable, size);}
+            if (executable != MAP_FAILED) {munmap(executable, size);}
+        }
+    }
+    close(fd); // the mappings keep the memory
+    return chunk;
+}
+
+void unmapChunk(JitChunk* chunk) {
+    munmap(chunk->writable, chunk->size);
+    munmap(chunk->executable, chunk->size);
+    delete chunk;
+}
+
+#endif
+
+JitFunction::JitFunction(JitChunk* chunk, const void* code) {
+    this->chunk = chunk;
+    entry = (int (*)(const int*))code;
+}
+
+/*
+ * Function to compile bytecode into native code
+ * Returns nullptr when there is no JIT for this platform, the operand stack gets deeper than JIT_MAX_DEPTH (so pool
+ * threads cannot run out of machine stack) or no executable memory can be mapped; callers then keep using the
+ * interpreter. The code is appended to the current chunk, a full chunk is left to its functions and a new one mapped.
+ */
+JitFunction* JitFunction::compile(const pmr::vector<Instruction>& code) {
+#ifdef JIT_SUPPORTED
+    Emitter e;
+    if (!generate(code, e)) {return nullptr;}
+    size_t length = (e.bytes.size() + JIT_ALIGNMENT - 1) / JIT_ALIGNMENT * JIT_ALIGNMENT;
+    
+    JitArena& arena = jitArena();
+    lock_guard<mutex> guard(arena.lock);
+    JitChunk* chunk = arena.current;
+    if (!chunk || chunk->size - chunk->used < length) {
+        size_t page = (size_t)sysconf(_SC_PAGESIZE);
+        size_t size = length > JIT_CHUNK_SIZE ? (length + page - 1) / page * page : JIT_CHUNK_SIZE;
+        JitChunk* fresh = mapChunk(size);
+        if (!fresh) {return nullptr;}
+        if (chunk && chunk->live == 0) {
+            unmapChunk(chunk);
+        }
+        arena.current = chunk = fresh;
+    }
+    
+    memcpy(chunk->writable + chunk->used, e.bytes.data(), e.bytes.size());
+    const void* entry = chunk->executable + chunk->used;
+    chunk->used += length;
+    chunk->live++;
+    return new JitFunction(chunk, entry);
+#else
+    (void)code;
+    return nullptr;
+#endif
+}
+
+// The chunk goes once its last function does, unless new code is still being placed in it
+JitFunction::~JitFunction() {
+#ifdef JIT_SUPPORTED
+    JitArena& arena = jitArena();
+    lock_guard<mutex> guard(arena.lock);
+    if (--chunk->live == 0 && chunk != arena.current) {
+        unmapChunk(chunk);
+    }
+#endif
+}
+
+int JitFunction::operator()(const int* values) const {
+    return entry(values);
+}
@@ -0,0 +1,41 @@
+/* 
+ * File:   Jit.h
+ * Author: John Shelnutt
+ * Synopsis: Header file for the native code tier - translates a program's bytecode into x86-64 machine code placed in a shared executable arena
+ */
+
+#ifndef JIT_H
+#define JIT_H
+
+#include <vector>
+#include <memory_resource>
+#include <cstddef>
+using namespace std;
+
+struct Instruction;
+struct JitChunk;
+
+// Deepest operand stack compiled, native code keeps all but the top value on the machine stack (8 bytes each)
+const int JIT_MAX_DEPTH = 1024;
+
+/*
+ * Native code of one program
+ * The code is bump allocated from chunks of executable memory shared by the whole process, so a hundred thousand hot
+ * expressions take a few mappings instead of a page and a mapping each. A chunk is unmapped once none of the functions
+ * placed in it are left.
+ */
+class JitFunction {
+public:
+    static JitFunction* compile(const pmr::vector<Instruction>& code);
+    ~JitFunction();
+    int operator()(const int* values) const;
+private:
+    JitFunction(JitChunk* chunk, const void* code);
+    JitFunction(const JitFunction&) = delete;
+    JitFunction& operator=(const JitFunction&) = delete;
+    
+    JitChunk* chunk;  // holds the code
+    int (*entry)(const int* values);
+};
+
+#endif /* JIT_H */
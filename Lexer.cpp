@@ -0,0 +1,81 @@
+/* 
+ * File:   Lexer.cpp
+ * Author: John Shelnutt
+ * Synopsis: Single pass lexer - every character is classified once through a lookup table, and tokens are emitted as spans into the source with their type, priority and integer value already decided
+ */
+
+#include "Lexer.h"
+using namespace std;
+
+constexpr CharTable::CharTable() : cls() {
+    for (int c = 0; c < 256; c++) {
+        cls[c] = OTHER;
+    }
+    for (int c = 'a'; c <= 'z'; c++) {
+        cls[c] = ALPHA;
+        cls[c - 'a' + 'A'] = ALPHA;
+    }
+    for (int c = '0'; c <= '9'; c++) {
+        cls[c] = DIGIT;
+    }
+    cls[(unsigned char)' '] = SPACE;
+    cls[(unsigned char)'+'] = PLUS_MINUS;
+    cls[(unsigned char)'-'] = PLUS_MINUS;
+    cls[(unsigned char)'*'] = TIMES_DIV_MOD;
+    cls[(unsigned char)'/'] = TIMES_DIV_MOD;
+    cls[(unsigned char)'%'] = TIMES_DIV_MOD;
+    cls[(unsigned char)'='] = EQUALS;
+    cls[(unsigned char)'('] = OPEN;
+    cls[(unsigned char)')'] = CLOSE;
+}
+
+constexpr CharTable charTable; // built by the compiler, so it is filled in before any tokenizing can happen
+
+// Moves on to the first block after this one that is not all spaces, false if there is none
+bool TokenScanner::nextBlock(uint64_t& first) {
+    while (base + SCAN_BLOCK < n) {
+        load(base + SCAN_BLOCK);
+        first = masks.valid & ~masks.space;
+        if (first) {return true;}
+    }
+    return false;
+}
+
+// Reads an ordinary token that starts at start and runs at least to the end of the current block
+void TokenScanner::longToken(Token& token, size_t start) {
+    uint64_t bit = 1ULL << (start - base);
+    bool isId = (masks.alpha & bit) != 0;
+    bool isInt = (masks.digit & bit) != 0 && s[start] != '0';
+    bool alpha = false;
+    bool other = false;
+    uint64_t inside = 0 - bit;
+    size_t end = n;
+    while (true) {
+        uint64_t ends = (masks.space | masks.special | ~masks.valid) & inside;
+        if (ends) {
+            uint64_t stop = ends & (0 - ends);
+            inside &= stop - 1;
+            from = 0 - stop;
+            end = base + __builtin_ctzll(stop);
+        }
+        alpha |= (masks.alpha & inside) != 0;
+        other |= (inside & ~(masks.alpha | masks.digit)) != 0;
+        if (ends) {break;}
+        if (base + SCAN_BLOCK == n) {
+            from = 0;
+            break;
+        }
+        load(base + SCAN_BLOCK);
+        inside = ~0ULL;
+    }
+    makeToken(token, start, end, isId && !other, isInt && !alpha && !other);
+}
+
+// Function to split the source into tokens, see TokenScanner
+void tokenize(string_view source, pmr::vector<Token>& tokens) {
+    TokenScanner scanner(source);
+    Token t;
+    while (scanner.next(t)) {
+        tokens.push_back(t);
+    }
+}
@@ -0,0 +1,118 @@
+/* 
+ * File:   Lexer.h
+ * Author: John Shelnutt
+ * Synopsis: Header file for the lexer, which splits an expression into tokens in a single pass over its characters
+ */
+
+#ifndef LEXER_H
+#define LEXER_H
+
+#include <string>
+#include <vector>
+#include <memory_resource>
+#include <climits>
+#include "Token.h"
+#include "Scan.h"
+using namespace std;
+
+// Character classes, independent of the locale unlike isalpha/isdigit
+enum Char_class {OTHER, SPACE, ALPHA, DIGIT, PLUS_MINUS, TIMES_DIV_MOD, EQUALS, OPEN, CLOSE};
+
+struct CharTable {
+    unsigned char cls[256];
+    
+    constexpr CharTable();
+};
+
+extern const CharTable charTable;
+
+/*
+ * Reads the tokens of a source one at a time, with the characters classified 64 at a time into bitmasks (see Scan.h)
+ * Operators, = and braces are always single character tokens; anything else runs until the next space or special character.
+ * Those ordinary tokens are an ID if they start with a letter and are alphanumeric, an INT if they are all digits and
+ * do not start with 0, and INVALID otherwise. INT values that do not fit in an int saturate to INT_MAX.
+ * Spaces are skipped and token ends found by counting zero bits, not by testing characters one by one. Inline, so the
+ * parser's loop over the tokens is not a call per token.
+ */
+class TokenScanner {
+public:
+    TokenScanner(string_view source) : s((const unsigned char*)source.data()), n(source.length()) {
+        load(0);
+    }
+    
+    // Returns false if only spaces are left
+    bool next(Token& token) {
+        uint64_t first = masks.valid & ~masks.space & from;
+        if (!first && !nextBlock(first)) {return false;}
+        uint64_t bit = first & (0 - first);
+        size_t start = base + __builtin_ctzll(first);
+        if (masks.special & bit) {
+            from = 0 - (bit << 1);
+            switch (charTable.cls[s[start]]) {
+                case PLUS_MINUS:
+                    token = Token(OP, start, 1, 1, 0);
+                    return true;
+                case TIMES_DIV_MOD:
+                    token = Token(OP, start, 1, 2, 0);
+                    return true;
+                case EQUALS:
+                    token = Token(EQ, start, 1, -1, 0);
+                    return true;
+                case OPEN:
+                    token = Token(OpenBrace, start, 1, 0, 0);
+                    return true;
+                default:
+                    token = Token(CloseBrace, start, 1, 0, 0);
+                    return true;
+            }
+        }
+        
+        // Ordinary token - its end is the next space, special or the end of the source, unless it runs into the next block
+        uint64_t ends = (masks.space | masks.special | ~masks.valid) & (0 - bit);
+        if (!ends) {
+            longToken(token, start);
+            return true;
+        }
+        uint64_t end = ends & (0 - ends);
+        uint64_t inside = end - bit;
+        from = 0 - end;
+        bool alpha = (masks.alpha & inside) != 0;
+        bool other = (inside & ~(masks.alpha | masks.digit)) != 0;
+        makeToken(token, start, base + __builtin_ctzll(end), (masks.alpha & bit) && !other,
+                  (masks.digit & bit) && s[start] != '0' && !alpha && !other);
+        return true;
+    }
+private:
+    void load(size_t at) {
+        base = at;
+        from = ~0ULL;
+        classifyBlock(s + at, n - at < SCAN_BLOCK ? n - at : SCAN_BLOCK, masks);
+    }
+    
+    void makeToken(Token& token, size_t start, size_t end, bool isId, bool isInt) {
+        if (isId) {
+            token = Token(ID, start, end - start, -1, 0);
+        } else if (isInt) {
+            long long value = 0;
+            for (size_t j = start; j < end && value <= INT_MAX; j++) {
+                value = value * 10 + (s[j] - '0');
+            }
+            token = Token(INT, start, end - start, -1, value > INT_MAX ? INT_MAX : (int)value);
+        } else {
+            token = Token(INVALID, start, end - start, -1, 0);
+        }
+    }
+    
+    bool nextBlock(uint64_t& first);
+    void longToken(Token& token, size_t start);
+    
+    const unsigned char* s;
+    size_t n;
+    size_t base;        // offset of the block masks describes
+    uint64_t from;      // bits of the block not read yet
+    BlockMasks masks;
+};
+
+void tokenize(string_view source, pmr::vector<Token>& tokens);
+
+#endif /* LEXER_H */
@@ -0,0 +1,73 @@
+/* 
+ * File:   Numeric.h
+ * Author: John Shelnutt
+ * Synopsis: Header file for the arithmetic policies the evaluator is instantiated with - fast 32-bit, 64-bit, overflow-checked 32-bit and floating point
+ */
+
+#ifndef NUMERIC_H
+#define NUMERIC_H
+
+#include <cstdint>
+#include <cmath>
+using namespace std;
+
+// The last two only come from evaluations that check definedness themselves, like Expression::get_results
+enum EvalStatus {EVAL_OK, EVAL_OVERFLOW, EVAL_DIVISION_BY_ZERO, EVAL_UNDEFINED, EVAL_NOT_ARITHMETIC};
+
+enum Arithmetic {ARITHMETIC_INT32, ARITHMETIC_INT64, ARITHMETIC_CHECKED, ARITHMETIC_DOUBLE};
+
+/*
+ * A policy is a value type plus one static function per operator that stores a op b in r and returns the status
+ * Policies that cannot fail always return EVAL_OK, so after inlining the evaluator has no status checks left for them.
+ */
+
+// 32-bit arithmetic the way the native code does it: overflow wraps around, division by zero traps
+struct Int32Arithmetic {
+    typedef int32_t value_type;
+    static EvalStatus add(int32_t a, int32_t b, int32_t& r) {r = (int32_t)((uint32_t)a + (uint32_t)b); return EVAL_OK;}
+    static EvalStatus sub(int32_t a, int32_t b, int32_t& r) {r = (int32_t)((uint32_t)a - (uint32_t)b); return EVAL_OK;}
+    static EvalStatus mul(int32_t a, int32_t b, int32_t& r) {r = (int32_t)((uint32_t)a * (uint32_t)b); return EVAL_OK;}
+    static EvalStatus div(int32_t a, int32_t b, int32_t& r) {r = a / b; return EVAL_OK;}
+    static EvalStatus mod(int32_t a, int32_t b, int32_t& r) {r = a % b; return EVAL_OK;}
+};
+
+// The same with 64-bit values, so sums and products of 32-bit variables do not wrap
+struct Int64Arithmetic {
+    typedef int64_t value_type;
+    static EvalStatus add(int64_t a, int64_t b, int64_t& r) {r = (int64_t)((uint64_t)a + (uint64_t)b); return EVAL_OK;}
+    static EvalStatus sub(int64_t a, int64_t b, int64_t& r) {r = (int64_t)((uint64_t)a - (uint64_t)b); return EVAL_OK;}
+    static EvalStatus mul(int64_t a, int64_t b, int64_t& r) {r = (int64_t)((uint64_t)a * (uint64_t)b); return EVAL_OK;}
+    static EvalStatus div(int64_t a, int64_t b, int64_t& r) {r = a / b; return EVAL_OK;}
+    static EvalStatus mod(int64_t a, int64_t b, int64_t& r) {r = a % b; return EVAL_OK;}
+};
+
+// 32-bit arithmetic that reports overflow and division by zero instead of wrapping or trapping
+struct CheckedInt32Arithmetic {
+    typedef int32_t value_type;
+    static EvalStatus add(int32_t a, int32_t b, int32_t& r) {return __builtin_add_overflow(a, b, &r) ? EVAL_OVERFLOW : EVAL_OK;}
+    static EvalStatus sub(int32_t a, int32_t b, int32_t& r) {return __builtin_sub_overflow(a, b, &r) ? EVAL_OVERFLOW : EVAL_OK;}
+    static EvalStatus mul(int32_t a, int32_t b, int32_t& r) {return __builtin_mul_overflow(a, b, &r) ? EVAL_OVERFLOW : EVAL_OK;}
+    static EvalStatus div(int32_t a, int32_t b, int32_t& r) {
+        if (b == 0) {return EVAL_DIVISION_BY_ZERO;}
+        if (b == -1 && a == INT32_MIN) {return EVAL_OVERFLOW;}
+        r = a / b;
+        return EVAL_OK;
+    }
+    static EvalStatus mod(int32_t a, int32_t b, int32_t& r) {
+        if (b == 0) {return EVAL_DIVISION_BY_ZERO;}
+        r = b == -1 ? 0 : a % b;
+        return EVAL_OK;
+    }
+};
+
+// IEEE doubles: / divides exactly, % is fmod, and division by zero gives an infinity or NaN
+struct DoubleArithmetic {
+    typedef double value_type;
+    static EvalStatus add(double a, double b, double& r) {r = a + b; return EVAL_OK;}
+    static EvalStatus sub(double a, double b, double& r) {r = a - b; return EVAL_OK;}
+    static EvalStatus mul(double a, double b, double& r) {r = a * b; return EVAL_OK;}
+    static EvalStatus div(double a, double b, double& r) {r = a / b; return EVAL_OK;}
+    static EvalStatus mod(double a, double b, double& r) {r = fmod(a, b); return EVAL_OK;}
+};
+
+#endif /* NUMERIC_H */
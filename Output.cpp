@@ -0,0 +1,314 @@
+/* 
+ * File:   Output.cpp
+ * Author: John Shelnutt
+ * Synopsis: Implements the output buffer and the text, NDJSON and binary sinks the print actions write through
+ */
+
+#include "Output.h"
+#include <charconv>
+#include <cerrno>
+#include <unistd.h>
+using namespace std;
+
+OutputBuffer::OutputBuffer(int fd, size_t capacity) : data(new char[capacity]), capacity(capacity), used(0), fd(fd),
+                                                      stream(nullptr), target(nullptr), error(false) {
+}
+
+OutputBuffer::OutputBuffer(ostream& out, size_t capacity) : data(new char[capacity]), capacity(capacity), used(0), fd(-1),
+                                                            stream(&out), target(nullptr), error(false) {
+}
+
+// Nothing is buffered, every write appends to out
+OutputBuffer::OutputBuffer(string& out) : capacity(0), used(0), fd(-1), stream(nullptr), target(&out), error(false) {
+}
+
+OutputBuffer::~OutputBuffer() {
+    flush();
+}
+
+// Hands the buffered bytes on to the target; a stream target is not flushed itself
+void OutputBuffer::flush() {
+    if (used != 0) {
+        send(data.get(), used);
+        used = 0;
+    }
+}
+
+// True once a write to the file descriptor or stream failed, everything after that is dropped
+bool OutputBuffer::failed() const {
+    return error;
+}
+
+// Slow path of write and put: the bytes do not fit in what is left of the buffer
+void OutputBuffer::overflow(const char* s, size_t length) {
+    if (target) {
+        target->append(s, length);
+        return;
+    }
+    flush();
+    if (length >= capacity) {
+        send(s, length);
+    } else {
+        memcpy(data.get(), s, length);
+        used = length;
+    }
+}
+
+void OutputBuffer::send(const char* s, size_t length) {
+    if (error) {return;}
+    if (target) {
+        target->append(s, length);
+    } else if (stream) {
+        stream->write(s, (streamsize)length);
+        error = stream->fail();
+    } else {
+        while (length > 0) {
+            ssize_t n = ::write(fd, s, length);
+            if (n < 0 && errno == EINTR) {continue;}
+            if (n <= 0) {
+                error = true;
+                return;
+            }
+            s += n;
+            length -= (size_t)n;
+        }
+    }
+}
+
+void OutputBuffer::write_int(int64_t value) {
+    char digits[24];
+    to_chars_result r = to_chars(digits, digits + sizeof(digits), value);
+    write(digits, (size_t)(r.ptr - digits));
+}
+
+// Shortest of up to 15 significant digits, like printf's %.15g, with -0 written as 0 and NaN without a sign
+void OutputBuffer::write_double(double value) {
+    if (value != value) {
+        write("nan", 3);
+        return;
+    }
+    char digits[32];
+    to_chars_result r = to_chars(digits, digits + sizeof(digits), value + 0.0, chars_format::general, 15);
+    write(digits, (size_t)(r.ptr - digits));
+}
+
+const char* typeName(Exp_type type) {
+    switch (type) {
+        case assignment:
+            return "assignment";
+        case arithmetic:
+            return "arithmetic";
+        default:
+            return "illegal";
+    }
+}
+
+// Text for OUTPUT_OVERFLOW and OUTPUT_DIVISION_BY_ZERO, the other errors have none
+const char* errorText(OutputError error) {
+    switch (error) {
+        case OUTPUT_NOT_ARITHMETIC:
+            return "not arithmetic";
+        case OUTPUT_UNDEFINED:
+            return "undefined variable";
+        case OUTPUT_OVERFLOW:
+            return "overflow";
+        case OUTPUT_DIVISION_BY_ZERO:
+            return "division by zero";
+        default:
+            return "";
+    }
+}
+
+// Writes the line of an expression without a result, returns false if there is no error
+bool TextSink::writeError(string_view original, OutputError error) {
+    if (error == OUTPUT_OK) {return false;}
+    out.write("cannot evaluate ", 16);
+    out.write(original);
+    if (error == OUTPUT_OVERFLOW || error == OUTPUT_DIVISION_BY_ZERO) {
+        out.write(": ", 2);
+        out.write(errorText(error), strlen(errorText(error)));
+    }
+    out.put('\n');
+    return true;
+}
+
+void TextSink::result(string_view original, Exp_type type, OutputError error, int64_t value) {
+    (void)type;
+    if (writeError(original, error)) {return;}
+    out.write(original);
+    out.write(" = ", 3);
+    out.write_int(value);
+    out.put('\n');
+}
+
+void TextSink::result(string_view original, Exp_type type, OutputError error, double value) {
+    (void)type;
+    if (writeError(original, error)) {return;}
+    out.write(original);
+    out.write(" = ", 3);
+    out.write_double(value);
+    out.put('\n');
+}
+
+void TextSink::form(OutputForm form, string_view original, Exp_type type, string_view text) {
+    if (type != arithmetic) {
+        out.write(original);
+        if (form == FORM_PARENTHESIZED) {
+            out.write(" cannot be parenthesized\n", 25);
+        } else if (form == FORM_PREFIX) {
+            out.write(" is not arithmetic and has no prefix\n", 37);
+        } else {
+            out.write(" is not arithmetic and has no postfix\n", 38);
+        }
+        return;
+    }
+    if (form == FORM_PARENTHESIZED) {
+        out.write("fully parenthesizing ", 21);
+    } else if (form == FORM_PREFIX) {
+        out.write("prefix of ", 10);
+    } else {
+        out.write("postfix of ", 11);
+    }
+    out.write(original);
+    out.write(" is: ", 5);
+    out.write(text);
+    if (form == FORM_POSTFIX) {
+        out.put(' ');
+    }
+    out.put('\n');
+}
+
+// True if none of the 8 bytes at s has to be escaped in a JSON string: no ", no \\ and no control character
+bool plainWord(const char* s) {
+    const uint64_t ONES = 0x0101010101010101ULL;
+    uint64_t w;
+    memcpy(&w, s, sizeof(w));
+    uint64_t quote = w ^ (ONES * '"');
+    uint64_t backslash = w ^ (ONES * '\\');
+    uint64_t found = ((quote - ONES) & ~quote) | ((backslash - ONES) & ~backslash) | ((w - ONES * 0x20) & ~w);
+    return (found & (ONES * 0x80)) == 0;
+}
+
+// A JSON string, quotes included, runs of characters that need no escaping are copied in one write
+void JsonSink::writeString(string_view s) {
+    static const char HEX[] = "0123456789abcdef";
+    out.put('"');
+    size_t start = 0;
+    for (size_t i = 0; i < s.size(); i++) {
+        while (i + 8 <= s.size() && plainWord(s.data() + i)) {
+            i += 8;
+        }
+        if (i == s.size()) {break;}
+        char c = s[i];
+        if (c != '"' && c != '\\' && (unsigned char)c >= 0x20) {continue;}
+        out.write(s.data() + start, i - start);
+        if (c == '"' || c == '\\') {
+            char escape[2] = {'\\', c};
+            out.write(escape, sizeof(escape));
+        } else {
+            char escape[6] = {'\\', 'u', '0', '0', HEX[(c >> 4) & 0xF], HEX[c & 0xF]};
+            out.write(escape, sizeof(escape));
+        }
+        start = i + 1;
+    }
+    out.write(s.data() + start, s.size() - start);
+    out.put('"');
+}
+
+void JsonSink::writeStart(string_view original, Exp_type type) {
+    out.write("{\"original\":", 12);
+    writeString(original);
+    out.write(",\"type\":\"", 9);
+    out.write(typeName(type), strlen(typeName(type)));
+    out.put('"');
+}
+
+// Finishes the record with its error, returns false if there is no error
+bool JsonSink::writeError(OutputError error) {
+    if (error == OUTPUT_OK) {return false;}
+    out.write(",\"error\":\"", 10);
+    out.write(errorText(error), strlen(errorText(error)));
+    out.write("\"}\n", 3);
+    return true;
+}
+
+void JsonSink::result(string_view original, Exp_type type, OutputError error, int64_t value) {
+    writeStart(original, type);
+    if (writeError(error)) {return;}
+    out.write(",\"result\":", 10);
+    out.write_int(value);
+    out.write("}\n", 2);
+}
+
+void JsonSink::result(string_view original, Exp_type type, OutputError error, double value) {
+    writeStart(original, type);
+    if (writeError(error)) {return;}
+    out.write(",\"result\":", 10);
+    if (value != value) {
+        out.write("\"nan\"", 5);
+    } else if (value == 1.0 / 0.0 || value == -1.0 / 0.0) {
+        out.write(value > 0 ? "\"inf\"" : "\"-inf\"", value > 0 ? 5 : 6);
+    } else {
+        out.write_double(value);
+    }
+    out.write("}\n", 2);
+}
+
+void JsonSink::form(OutputForm form, string_view original, Exp_type type, string_view text) {
+    writeStart(original, type);
+    if (type != arithmetic) {
+        writeError(OUTPUT_NOT_ARITHMETIC);
+        return;
+    }
+    if (form == FORM_PARENTHESIZED) {
+        out.write(",\"parenthesized\":", 17);
+    } else if (form == FORM_PREFIX) {
+        out.write(",\"prefix\":", 10);
+    } else {
+        out.write(",\"postfix\":", 11);
+    }
+    writeString(text);
+    out.write("}\n", 2);
+}
+
+BinarySink::BinarySink(OutputBuffer& out) : OutputSink(out) {
+    out.write("CALCOUT1", 8);
+}
+
+void BinarySink::writeHeader(uint8_t kind, string_view original, Exp_type type, OutputError error) {
+    char header[8] = {(char)kind, (char)type, (char)error, 0};
+    uint32_t length = (uint32_t)original.size();
+    memcpy(header + 4, &length, sizeof(length));
+    out.write(header, sizeof(header));
+    out.write(original);
+}
+
+void BinarySink::result(string_view original, Exp_type type, OutputError error, int64_t value) {
+    writeHeader(BINARY_INT_RESULT, original, type, error);
+    if (error != OUTPUT_OK) {value = 0;}
+    out.write((const char*)&value, sizeof(value));
+}
+
+void BinarySink::result(string_view original, Exp_type type, OutputError error, double value) {
+    writeHeader(BINARY_DOUBLE_RESULT, original, type, error);
+    if (error != OUTPUT_OK) {value = 0;}
+    out.write((const char*)&value, sizeof(value));
+}
+
+void BinarySink::form(OutputForm form, string_view original, Exp_type type, string_view text) {
+    writeHeader((uint8_t)(BINARY_FORM + form), original, type, type == arithmetic ? OUTPUT_OK : OUTPUT_NOT_ARITHMETIC);
+    uint32_t length = type == arithmetic ? (uint32_t)text.size() : 0;
+    out.write((const char*)&length, sizeof(length));
+    out.write(text.data(), length);
+}
+
+unique_ptr<OutputSink> makeSink(OutputFormat format, OutputBuffer& out) {
+    switch (format) {
+        case OUTPUT_NDJSON:
+            return unique_ptr<OutputSink>(new JsonSink(out));
+        case OUTPUT_BINARY:
+            return unique_ptr<OutputSink>(new BinarySink(out));
+        default:
+            return unique_ptr<OutputSink>(new TextSink(out));
+    }
+}
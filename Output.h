@@ -0,0 +1,161 @@
+/* 
+ * File:   Output.h
+ * Author: John Shelnutt
+ * Synopsis: Header file for the output layer every print action writes through - a large reusable buffer with fast number formatting, and sinks for the text, NDJSON and binary formats
+ */
+
+#ifndef OUTPUT_H
+#define OUTPUT_H
+
+#include <string>
+#include <string_view>
+#include <iostream>
+#include <memory>
+#include <cstring>
+#include <cstdint>
+#include "Expression.h"
+using namespace std;
+
+const size_t DEFAULT_OUTPUT_BUFFER = 1 << 16;
+
+/*
+ * Buffer in front of a file descriptor, a stream or a string
+ * Bytes are only handed on when the buffer is full, on flush() and on destruction, so printing a line costs a memcpy.
+ * A string target is appended to directly, it already is a buffer.
+ */
+class OutputBuffer {
+public:
+    explicit OutputBuffer(int fd, size_t capacity = DEFAULT_OUTPUT_BUFFER);
+    explicit OutputBuffer(ostream& out, size_t capacity = DEFAULT_OUTPUT_BUFFER);
+    explicit OutputBuffer(string& out);
+    ~OutputBuffer();
+    void write(const char* s, size_t length) {
+        if (length < capacity - used) {
+            memcpy(data.get() + used, s, length);
+            used += length;
+        } else {
+            overflow(s, length);
+        }
+    }
+    void write(string_view s) {write(s.data(), s.size());}
+    void put(char c) {
+        if (used < capacity) {
+            data[used++] = c;
+        } else {
+            overflow(&c, 1);
+        }
+    }
+    void write_int(int64_t value);
+    void write_double(double value);
+    void flush();
+    bool failed() const;
+private:
+    OutputBuffer(const OutputBuffer&) = delete;
+    OutputBuffer& operator=(const OutputBuffer&) = delete;
+
+    unique_ptr<char[]> data;
+    size_t capacity;
+    size_t used;
+    int fd;            // -1 unless writing to a file descriptor
+    ostream* stream;   // nullptr unless writing to a stream
+    string* target;    // nullptr unless appending to a string
+    bool error;
+
+    // Helper functions
+    void overflow(const char* s, size_t length);
+    void send(const char* s, size_t length);
+};
+
+enum OutputFormat {OUTPUT_TEXT, OUTPUT_NDJSON, OUTPUT_BINARY};
+
+// Why an expression has no result
+enum OutputError {OUTPUT_OK, OUTPUT_NOT_ARITHMETIC, OUTPUT_UNDEFINED, OUTPUT_OVERFLOW, OUTPUT_DIVISION_BY_ZERO};
+
+// What an evaluation status is printed as
+inline OutputError outputError(EvalStatus status) {
+    switch (status) {
+        case EVAL_OVERFLOW:
+            return OUTPUT_OVERFLOW;
+        case EVAL_DIVISION_BY_ZERO:
+            return OUTPUT_DIVISION_BY_ZERO;
+        case EVAL_UNDEFINED:
+            return OUTPUT_UNDEFINED;
+        case EVAL_NOT_ARITHMETIC:
+            return OUTPUT_NOT_ARITHMETIC;
+        default:
+            return OUTPUT_OK;
+    }
+}
+
+enum OutputForm {FORM_PREFIX, FORM_POSTFIX, FORM_PARENTHESIZED};
+
+/*
+ * One record per expression and action, formatted into an OutputBuffer
+ * value is only meaningful when error is OUTPUT_OK, text only when type is arithmetic.
+ */
+class OutputSink {
+public:
+    OutputSink(OutputBuffer& out) : out(out) {}
+    virtual ~OutputSink() {}
+    virtual void result(string_view original, Exp_type type, OutputError error, int64_t value) = 0;
+    virtual void result(string_view original, Exp_type type, OutputError error, double value) = 0;
+    virtual void form(OutputForm form, string_view original, Exp_type type, string_view text) = 0;
+    void flush() {out.flush();}
+protected:
+    OutputBuffer& out;
+};
+
+// The lines the calculator has always printed
+class TextSink : public OutputSink {
+public:
+    TextSink(OutputBuffer& out) : OutputSink(out) {}
+    void result(string_view original, Exp_type type, OutputError error, int64_t value) override;
+    void result(string_view original, Exp_type type, OutputError error, double value) override;
+    void form(OutputForm form, string_view original, Exp_type type, string_view text) override;
+private:
+    bool writeError(string_view original, OutputError error);
+};
+
+/*
+ * One JSON object per line: {"original": ..., "type": ..., then "result", "prefix", "postfix" or "parenthesized",
+ * or "error": "not arithmetic" | "undefined variable" | "overflow" | "division by zero"}.
+ * Infinite and NaN double results are the strings "inf", "-inf" and "nan".
+ */
+class JsonSink : public OutputSink {
+public:
+    JsonSink(OutputBuffer& out) : OutputSink(out) {}
+    void result(string_view original, Exp_type type, OutputError error, int64_t value) override;
+    void result(string_view original, Exp_type type, OutputError error, double value) override;
+    void form(OutputForm form, string_view original, Exp_type type, string_view text) override;
+private:
+    void writeStart(string_view original, Exp_type type);
+    void writeString(string_view s);
+    bool writeError(OutputError error);
+};
+
+/*
+ * Binary records in the byte order of the writing machine, after the 8 byte magic "CALCOUT1":
+ *   uint8_t  kind     BINARY_INT_RESULT, BINARY_DOUBLE_RESULT, or BINARY_FORM + OutputForm
+ *   uint8_t  type     Exp_type
+ *   uint8_t  error    OutputError
+ *   uint8_t  reserved
+ *   uint32_t originalLength, then the original text
+ *   results: int64_t or double value (0 on error); forms: uint32_t textLength, then the text
+ */
+const uint8_t BINARY_INT_RESULT = 1;
+const uint8_t BINARY_DOUBLE_RESULT = 2;
+const uint8_t BINARY_FORM = 3;
+
+class BinarySink : public OutputSink {
+public:
+    BinarySink(OutputBuffer& out);
+    void result(string_view original, Exp_type type, OutputError error, int64_t value) override;
+    void result(string_view original, Exp_type type, OutputError error, double value) override;
+    void form(OutputForm form, string_view original, Exp_type type, string_view text) override;
+private:
+    void writeHeader(uint8_t kind, string_view original, Exp_type type, OutputError error);
+};
+
+unique_ptr<OutputSink> makeSink(OutputFormat format, OutputBuffer& out);
+
+#endif /* OUTPUT_H */
@@ -0,0 +1,67 @@
+/* 
+ * File:   ParallelEvaluator.cpp
+ * Author: John Shelnutt
+ * Synopsis: Splits an expression sequence into chunks of roughly equal work and evaluates them on a work-stealing pool, writing every result into its own slot of a preallocated array so output keeps input order
+ */
+
+#include "ParallelEvaluator.h"
+#include "Stats.h"
+using namespace std;
+
+// Instructions per chunk - small enough that stealing can even out uneven expressions, big enough to keep scheduling cheap
+const size_t CHUNK_WORK = 1 << 14;
+
+EvalResult evaluateOne(const Expression& e, const SymbolTable& symbols) {
+    EvalResult r;
+    r.value = 0;
+    r.evaluated = false;
+    if (!e.is_arithmetic()) {return r;}
+    
+    {
+        STATS_PHASE(PHASE_UNDEFINED_CHECK);
+        for (int id : e.get_variables()) {
+            if (!symbols.is_defined(id)) {return r;}
+        }
+    }
+    r.value = e.get_result(symbols);
+    r.evaluated = true;
+    return r;
+}
+
+/*
+ * Function to evaluate every expression of the sequence
+ * The variable table is only read, so it acts as the snapshot every worker evaluates against
+ */
+void evaluateSequence(const pmr::vector<Expression>& expressions, const SymbolTable& symbols,
+                      pmr::vector<EvalResult>& results, ThreadPool& pool) {
+    pmr::vector<size_t> indices(expressions.size());
+    for (size_t i = 0; i < indices.size(); i++) {
+        indices[i] = i;
+    }
+    results.resize(expressions.size());
+    evaluateExpressions(expressions, indices, symbols, results, pool);
+}
+
+// Evaluates only the listed expressions, results must already have a slot for every expression
+void evaluateExpressions(const pmr::vector<Expression>& expressions, const pmr::vector<size_t>& indices,
+                         const SymbolTable& symbols, pmr::vector<EvalResult>& results, ThreadPool& pool) {
+    // Chunk boundaries by accumulated program size, not expression count, so one huge expression gets a chunk to itself
+    vector<size_t> bounds(1, 0);
+    size_t work = 0;
+    for (size_t i = 0; i < indices.size(); i++) {
+        work += expressions[indices[i]].get_program_size() + 1;
+        if (work >= CHUNK_WORK) {
+            bounds.push_back(i + 1);
+            work = 0;
+        }
+    }
+    if (bounds.back() != indices.size()) {
+        bounds.push_back(indices.size());
+    }
+    
+    pool.run(bounds.size() - 1, [&](size_t chunk) {
+        for (size_t i = bounds[chunk]; i < bounds[chunk + 1]; i++) {
+            results[indices[i]] = evaluateOne(expressions[indices[i]], symbols);
+        }
+    });
+}
@@ -0,0 +1,28 @@
+/* 
+ * File:   ParallelEvaluator.h
+ * Author: John Shelnutt
+ * Synopsis: Header file for evaluating a whole expression sequence on a thread pool against a fixed variable table
+ */
+
+#ifndef PARALLELEVALUATOR_H
+#define PARALLELEVALUATOR_H
+
+#include <vector>
+#include <memory_resource>
+#include "Expression.h"
+#include "SymbolTable.h"
+#include "ThreadPool.h"
+using namespace std;
+
+struct EvalResult {
+    int value;
+    bool evaluated; // false for non-arithmetic expressions and expressions with undefined variables
+};
+
+EvalResult evaluateOne(const Expression& e, const SymbolTable& symbols);
+void evaluateSequence(const pmr::vector<Expression>& expressions, const SymbolTable& symbols,
+                      pmr::vector<EvalResult>& results, ThreadPool& pool);
+void evaluateExpressions(const pmr::vector<Expression>& expressions, const pmr::vector<size_t>& indices,
+                         const SymbolTable& symbols, pmr::vector<EvalResult>& results, ThreadPool& pool);
+
+#endif /* PARALLELEVALUATOR_H */
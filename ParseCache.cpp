@@ -0,0 +1,137 @@
+/* 
+ * File:   ParseCache.cpp
+ * Author: John Shelnutt
+ * Synopsis: File to implement the least recently used cache of compiled expression forms
+ */
+
+#include "ParseCache.h"
+using namespace std;
+
+// Bookkeeping per entry besides the form itself: the list node, the hash node and its bucket, the shared_ptr control block
+const size_t ENTRY_OVERHEAD = sizeof(pmr::list<int>) + 2 * sizeof(void*) + sizeof(pair<string_view, void*>) + 3 * sizeof(void*) + 16;
+
+// Collapses every run of spaces into one space and drops the spaces at both ends
+void normalize(const string& s, string& out) {
+    out.clear();
+    bool space = false;
+    for (char c : s) {
+        if (c == ' ') {
+            space = true;
+            continue;
+        }
+        if (space && !out.empty()) {out += ' ';}
+        space = false;
+        out += c;
+    }
+}
+
+/*
+ * Function to find the character of original that ends up at position of its normalized text
+ * The space a run of spaces collapses into maps to the run's last space. The end of the normalized text maps to the end
+ * of original, trailing spaces included.
+ */
+size_t originalOffset(string_view original, size_t position) {
+    size_t emitted = 0; // length of the normalized text so far
+    bool space = false;
+    for (size_t i = 0; i < original.length(); i++) {
+        if (original[i] == ' ') {
+            space = true;
+            continue;
+        }
+        if (space && emitted > 0) {
+            if (emitted == position) {return i - 1;}
+            emitted++;
+        }
+        space = false;
+        if (emitted == position) {return i;}
+        emitted++;
+    }
+    return original.length();
+}
+
+ParseCache::ParseCache(size_t memoryLimit) : entries(&pool), index(&pool), memoryLimit(memoryLimit), memory(0), hits(0), misses(0), evictions(0) {
+}
+
+/*
+ * Function to get the compiled form of s
+ * On a miss the normalized text is parsed and the form is cached, evicting the least recently used forms over the memory limit
+ */
+shared_ptr<const CompiledExpression> ParseCache::get(const string& s, SymbolTable& symbols) {
+    shared_ptr<CompiledExpression> form;
+    if (memoryLimit == 0) {
+        form = make_shared<CompiledExpression>();
+        form->source = s;
+        form->parse(symbols);
+        return form;
+    }
+    
+    normalize(s, key);
+    pmr::unordered_map<string_view, pmr::list<Entry>::iterator>::iterator found = index.find(string_view(key));
+    if (found != index.end()) {
+        hits++;
+        entries.splice(entries.begin(), entries, found->second);
+        return found->second->form;
+    }
+    
+    misses++;
+    form = allocate_shared<CompiledExpression>(pmr::polymorphic_allocator<CompiledExpression>(&pool), &pool);
+    form->source = key;
+    form->parse(symbols);
+    Entry e = {form, form->get_memory() + ENTRY_OVERHEAD};
+    if (e.bytes > memoryLimit) {return form;} // would only push everything else out
+    
+    entries.push_front(e);
+    index[string_view(form->source)] = entries.begin();
+    memory += e.bytes;
+    while (memory > memoryLimit) {
+        evictOldest();
+    }
+    return form;
+}
+
+void ParseCache::evictOldest() {
+    Entry& oldest = entries.back();
+    index.erase(string_view(oldest.form->source));
+    memory -= oldest.bytes;
+    entries.pop_back();
+    evictions++;
+}
+
+// Drops every form, the counters are kept
+void ParseCache::clear() {
+    index.clear();
+    entries.clear();
+    memory = 0;
+}
+
+void ParseCache::set_memory_limit(size_t bytes) {
+    memoryLimit = bytes;
+    while (memory > memoryLimit) {
+        evictOldest();
+    }
+}
+
+size_t ParseCache::get_memory_limit() const {
+    return memoryLimit;
+}
+
+// Approximate bytes held by the cached forms and their bookkeeping
+size_t ParseCache::get_memory() const {
+    return memory;
+}
+
+size_t ParseCache::size() const {
+    return entries.size();
+}
+
+unsigned long long ParseCache::get_hits() const {
+    return hits;
+}
+
+unsigned long long ParseCache::get_misses() const {
+    return misses;
+}
+
+unsigned long long ParseCache::get_evictions() const {
+    return evictions;
+}
@@ -0,0 +1,62 @@
+/* 
+ * File:   ParseCache.h
+ * Author: John Shelnutt
+ * Synopsis: Header file for the parse cache - compiled forms of recently seen expression texts, so a repeated expression costs a hash lookup instead of a parse
+ */
+
+#ifndef PARSECACHE_H
+#define PARSECACHE_H
+
+#include <string>
+#include <string_view>
+#include <list>
+#include <unordered_map>
+#include <memory>
+#include <memory_resource>
+#include "Expression.h"
+#include "SymbolTable.h"
+using namespace std;
+
+const size_t DEFAULT_PARSE_CACHE_BYTES = 16 << 20;
+
+/*
+ * Least recently used cache of compiled forms keyed by the source text with runs of spaces collapsed and the ends trimmed
+ * The lexer treats all of those texts alike. Variables are interned when a form is built, so every get has to pass the
+ * same symbol table and the cache has to be cleared together with it. Forms that are evicted stay alive for as long as
+ * expressions hold them; the memory limit only covers the cache's own references. Forms and entries come from a pool
+ * owned by the cache, so evictions hand their memory straight to the next miss, and no form may outlive the cache.
+ */
+class ParseCache {
+public:
+    ParseCache(size_t memoryLimit = DEFAULT_PARSE_CACHE_BYTES);
+    shared_ptr<const CompiledExpression> get(const string& s, SymbolTable& symbols);
+    void clear();
+    void set_memory_limit(size_t bytes); // 0 turns the cache off
+    size_t get_memory_limit() const;
+    size_t get_memory() const;
+    size_t size() const;
+    unsigned long long get_hits() const;
+    unsigned long long get_misses() const;
+    unsigned long long get_evictions() const;
+private:
+    struct Entry {
+        shared_ptr<const CompiledExpression> form;
+        size_t bytes;
+    };
+    pmr::unsynchronized_pool_resource pool;
+    pmr::list<Entry> entries; // most recently used first
+    pmr::unordered_map<string_view, pmr::list<Entry>::iterator> index; // keys point into the source of the entry's form
+    string key; // normalized text of the last lookup, reused so hits do not allocate
+    size_t memoryLimit;
+    size_t memory;
+    unsigned long long hits;
+    unsigned long long misses;
+    unsigned long long evictions;
+    
+    // Helper functions
+    void evictOldest();
+};
+
+size_t originalOffset(string_view original, size_t position);
+
+#endif /* PARSECACHE_H */
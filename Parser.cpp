@@ -0,0 +1,112 @@
+/* 
+ * File:   Parser.cpp
+ * Author: John Shelnutt
+ * Synopsis: Single pass parser - every token is validated and put in postfix order as soon as the lexer reads it
+ */
+
+#include "Parser.h"
+#include "Lexer.h"
+using namespace std;
+
+// Records the first error only, the ones after it are consequences
+void fail(ParseError& error, const char* message, size_t position) {
+    if (error.message) {return;}
+    error.message = message;
+    error.position = position;
+}
+
+/*
+ * Function to tokenize source into tokens, check that it is an arithmetic expression or an assignment, and put the tokens
+ * of an arithmetic expression in postfix order
+ * Operands and operators have to alternate, starting and ending with an operand; braces have to balance. An = turns the
+ * expression into an assignment, which has to be exactly a variable, = and an integer. Operators are ordered with a
+ * shunting-yard stack while the tokens are read, so nothing is looked at twice. This is not the Pratt parser that was
+ * asked for: with only left associative binary operators both give the same order, and the operator stack fits the
+ * token at a time loop (and the postfix the compiler takes) without recursion that deep nesting could overflow.
+ * Returns the type, illegal with error set if the expression is rejected; postfix is only filled in for arithmetic.
+ * The error position is the offset of the rejected token, or the length of the source when it ends too early.
+ * tokens always gets every token of the source, also after an error.
+ */
+Exp_type parseExpression(string_view source, pmr::vector<Token>& tokens, pmr::vector<Token>& postfix, ParseError& error) {
+    size_t n = source.length();
+    error.message = nullptr;
+    error.position = 0;
+    if (source.find_first_not_of(' ') == string_view::npos) { // stops at the first character of anything else
+        fail(error, "empty expression", n);
+        return illegal;
+    }
+    
+    // Operators and open braces not in postfix yet, only nested expressions need more than the stack buffer
+    alignas(Token) char buffer[32 * sizeof(Token)];
+    pmr::monotonic_buffer_resource arena(buffer, sizeof(buffer));
+    pmr::vector<Token> ops(&arena);
+    ops.reserve(32);
+    
+    bool expectOperand = true;
+    int depth = 0;              // open braces not closed yet
+    size_t equals = n;          // offset of the first =, n if there is none
+    TokenScanner scanner(source);
+    Token t;
+    while (scanner.next(t)) {
+        tokens.push_back(t);
+        if (error.message) {continue;}
+    
+        Token_type type = t.get_type();
+        if (expectOperand) {
+            if (type == INT || type == ID) {
+                postfix.push_back(t);
+                expectOperand = false;
+            } else if (type == OpenBrace) {
+                ops.push_back(t);
+                depth++;
+            } else {
+                fail(error, "expected a number, a variable or (", t.get_offset());
+            }
+        } else if (type == OP) {
+            while (!ops.empty() && ops.back().get_priority() >= t.get_priority()) {
+                postfix.push_back(ops.back());
+                ops.pop_back();
+            }
+            ops.push_back(t);
+            expectOperand = true;
+        } else if (type == CloseBrace) {
+            if (depth == 0) {
+                fail(error, "unmatched )", t.get_offset());
+                continue;
+            }
+            while (ops.back().get_type() != OpenBrace) {
+                postfix.push_back(ops.back());
+                ops.pop_back();
+            }
+            ops.pop_back();
+            depth--;
+        } else if (type == EQ) {
+            if (equals == n) {equals = t.get_offset();}
+            expectOperand = true;
+        } else {
+            fail(error, "expected an operator or )", t.get_offset());
+        }
+    }
+    
+    if (expectOperand) {
+        fail(error, "expected a number, a variable or (", n);
+    } else if (depth != 0) {
+        fail(error, "missing )", n);
+    } else if (equals != n && !(tokens.size() == 3 && tokens[0].get_type() == ID && tokens[2].get_type() == INT)) {
+        fail(error, "an assignment has to be a variable = an integer", equals);
+    }
+    if (error.message) {
+        postfix.clear();
+        return illegal;
+    }
+    if (equals != n) {
+        postfix.clear();
+        return assignment;
+    }
+    
+    while (!ops.empty()) {
+        postfix.push_back(ops.back());
+        ops.pop_back();
+    }
+    return arithmetic;
+}
@@ -0,0 +1,18 @@
+/* 
+ * File:   Parser.h
+ * Author: John Shelnutt
+ * Synopsis: Header file for the parser, which tokenizes, validates and orders an expression into postfix in one pass over its characters
+ */
+
+#ifndef PARSER_H
+#define PARSER_H
+
+#include <string_view>
+#include <memory_resource>
+#include "Token.h"
+#include "Expression.h"
+using namespace std;
+
+Exp_type parseExpression(string_view source, pmr::vector<Token>& tokens, pmr::vector<Token>& postfix, ParseError& error);
+
+#endif /* PARSER_H */
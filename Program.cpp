@@ -0,0 +1,350 @@
+/* 
+ * File:   Program.cpp
+ * Author: John Shelnutt
+ * Synopsis: Compiles postfix tokens into bytecode with literals decoded and variables resolved to slots, and runs that bytecode on a fixed-size operand stack
+ */
+
+#include "Program.h"
+#include <algorithm>
+#include <climits>
+using namespace std;
+
+// Runs before a program is compiled to native code, 0 turns the native tier off
+static atomic<unsigned> jitThreshold(1000);
+
+// Operand stacks up to this depth live on the C++ stack, deeper programs use a per-thread buffer that is only ever grown
+const int FIXED_STACK_SIZE = 64;
+
+int evaluate(int a, int b, Opcode op) {
+    int r;
+    applyOperator<Int32Arithmetic>(op, a, b, r);
+    return r;
+}
+
+Opcode getOpcode(char op) {
+    switch (op) {
+        case '+':
+            return ADD;
+        case '-':
+            return SUB;
+        case '*':
+            return MUL;
+        case '/':
+            return DIV;
+        default:
+            return MOD;
+    }
+}
+
+// code and variables are allocated from resource, copies of the program use the default resource
+Program::Program(pmr::memory_resource* resource) : code(resource), variables(resource), evaluations(0), native(nullptr) {
+    clear();
+}
+
+// Copies start over in the interpreter, native code is not shared between programs
+Program::Program(const Program& p) : code(p.code), variables(p.variables), maxDepth(p.maxDepth), evaluations(0), native(nullptr) {
+}
+
+Program::Program(Program&& p) : code(move(p.code)), variables(move(p.variables)), maxDepth(p.maxDepth),
+                                evaluations(p.evaluations.load()), native(p.native.exchange(nullptr)) {
+}
+
+Program::~Program() {
+    delete native.load();
+}
+
+Program& Program::operator=(const Program& p) {
+    if (this == &p) {return *this;}
+    clear();
+    code = p.code;
+    variables = p.variables;
+    maxDepth = p.maxDepth;
+    return *this;
+}
+
+Program& Program::operator=(Program&& p) {
+    if (this == &p) {return *this;}
+    clear();
+    code = move(p.code);
+    variables = move(p.variables);
+    maxDepth = p.maxDepth;
+    evaluations = p.evaluations.load();
+    native = p.native.exchange(nullptr);
+    return *this;
+}
+
+void Program::set_jit_threshold(unsigned evaluations) {
+    jitThreshold = evaluations;
+}
+
+void Program::clear() {
+    code.clear();
+    variables.clear();
+    maxDepth = 0;
+    evaluations = 0;
+    delete native.exchange(nullptr);
+}
+
+// Releases the spare capacity left over from compiling
+void Program::shrink() {
+    code.shrink_to_fit();
+    variables.shrink_to_fit();
+}
+
+// Moves the program to another symbol table, ids[old id] is the id of the same name in the new table
+void Program::remap(const vector<int>& ids) {
+    for (size_t i = 0; i < code.size(); i++) {
+        if (code[i].op == LOAD_SLOT) {
+            code[i].operand = ids[code[i].operand];
+        }
+    }
+    for (size_t i = 0; i < variables.size(); i++) {
+        variables[i] = ids[variables[i]];
+    }
+    sort(variables.begin(), variables.end());
+    delete native.exchange(nullptr);
+}
+
+/*
+ * Function to translate postfix tokens into bytecode
+ * Variables are interned into the symbol table, so at run time a variable is a single array access
+ */
+void Program::compile(const pmr::vector<Token>& postfix, string_view source, SymbolTable& symbols) {
+    clear();
+    code.reserve(postfix.size());
+    
+    for (size_t i = 0; i < postfix.size(); i++) {
+        const Token& t = postfix[i];
+        Instruction instr;
+        
+        if (t.get_type() == INT) {
+            instr.op = PUSH_CONST;
+            instr.operand = t.value();
+        } else if (t.get_type() == ID) {
+            instr.op = LOAD_SLOT;
+            instr.operand = symbols.intern(source.data() + t.get_offset(), t.get_length());
+            variables.push_back(instr.operand);
+        } else {
+            instr.op = getOpcode(source[t.get_offset()]);
+            instr.operand = 0;
+        }
+        code.push_back(instr);
+    }
+    
+    // variables keeps every variable of the source, even ones folding removes, so undefined checks are unchanged
+    sort(variables.begin(), variables.end());
+    variables.erase(unique(variables.begin(), variables.end()), variables.end());
+    
+    fold();
+    measureDepth();
+}
+
+/*
+ * Function to take over bytecode that was compiled before, e.g. by an earlier process (see Snapshot.h)
+ * ids are the distinct variables of the source expression, sorted. The code is expected to be well formed.
+ */
+void Program::load(const Instruction* instructions, size_t length, const int* ids, size_t count) {
+    clear();
+    code.assign(instructions, instructions + length);
+    variables.assign(ids, ids + count);
+    measureDepth();
+}
+
+void Program::measureDepth() {
+    int depth = 0;
+    for (size_t i = 0; i < code.size(); i++) {
+        depth += code[i].op == PUSH_CONST || code[i].op == LOAD_SLOT ? 1 : -1;
+        if (depth > maxDepth) {maxDepth = depth;}
+    }
+}
+
+// True if a op b gives the same value under every arithmetic policy, so it can be folded into one constant
+bool foldsExactly(Opcode op, int a, int b) {
+    int r;
+    switch (op) {
+        case ADD:
+            return !__builtin_add_overflow(a, b, &r);
+        case SUB:
+            return !__builtin_sub_overflow(a, b, &r);
+        case MUL:
+            return !__builtin_mul_overflow(a, b, &r);
+        case DIV:
+            return b != 0 && !(b == -1 && a == INT_MIN) && a % b == 0;
+        default:
+            return b != 0 && b != -1;
+    }
+}
+
+/*
+ * Function to fold constant subexpressions and apply integer identities, in one pass over the code
+ * Every operand on the simulated stack remembers where its instructions start in the output and whether it is a
+ * known constant. Folding must not change the result under any arithmetic policy (see Numeric.h), so constants are
+ * only folded when the 32-bit result is exact: no overflow, no trap and no remainder thrown away by a division.
+ * x+0, 0+x, x-0, x*1, 1*x and x/1 become x. x*0, 0*x and x%1 become 0, but only when x is a single constant or
+ * variable, otherwise folding would hide a division by zero, an overflow or an infinity.
+ */
+void Program::fold() {
+    struct Operand {
+        size_t start;   // first instruction of this operand in out
+        bool constant;
+        int value;
+        bool leaf;      // a single PUSH_CONST or LOAD_SLOT
+    };
+    // scratch kept per thread, so folding does not allocate once it has seen an expression this long
+    static thread_local vector<Operand> operands;
+    static thread_local vector<Instruction> out;
+    operands.clear();
+    out.clear();
+    
+    for (size_t i = 0; i < code.size(); i++) {
+        Instruction instr = code[i];
+        if (instr.op == PUSH_CONST || instr.op == LOAD_SLOT) {
+            Operand o = {out.size(), instr.op == PUSH_CONST, instr.operand, true};
+            operands.push_back(o);
+            out.push_back(instr);
+            continue;
+        }
+        
+        Operand b = operands.back();
+        operands.pop_back();
+        Operand a = operands.back();
+        operands.pop_back();
+        Opcode op = instr.op;
+        
+        Operand result = {a.start, false, 0, false};
+        if (a.constant && b.constant && foldsExactly(op, a.value, b.value)) {
+            result.constant = true;
+            result.value = evaluate(a.value, b.value, op);
+            result.leaf = true;
+            out.resize(a.start);
+            Instruction c = {PUSH_CONST, result.value};
+            out.push_back(c);
+        } else if (b.constant && (((op == ADD || op == SUB) && b.value == 0) || ((op == MUL || op == DIV) && b.value == 1))) {
+            out.resize(b.start);
+            result = a;
+        } else if (a.constant && ((op == ADD && a.value == 0) || (op == MUL && a.value == 1))) {
+            out.erase(out.begin() + a.start); // a constant is always a single PUSH_CONST
+            result = b;
+            result.start = a.start;
+        } else if ((((op == MUL && b.constant && b.value == 0) || (op == MOD && b.constant && b.value == 1)) && a.leaf)
+                   || (op == MUL && a.constant && a.value == 0 && b.leaf)) {
+            out.resize(a.start);
+            Instruction c = {PUSH_CONST, 0};
+            out.push_back(c);
+            result.constant = true;
+            result.value = 0;
+            result.leaf = true;
+        } else {
+            out.push_back(instr);
+        }
+        operands.push_back(result);
+    }
+    
+    code.assign(out.begin(), out.end()); // never longer than code, so this reuses its storage
+}
+
+/*
+ * Function to run the program given the value of every variable, indexed by symbol id
+ * Hot programs switch to native code; if that is not available they stay in the interpreter
+ */
+int Program::run(const int* values) const {
+    JitFunction* f = native.load(memory_order_acquire);
+    if (f) {
+        return (*f)(values);
+    }
+    
+    int result;
+    unsigned threshold = jitThreshold.load(memory_order_relaxed);
+    if (threshold != 0 && evaluations.fetch_add(1, memory_order_relaxed) + 1 == threshold) {
+        compileNative();
+        f = native.load(memory_order_acquire);
+        if (f) {
+            return (*f)(values);
+        }
+    }
+    run_code<Int32Arithmetic>(code.data(), code.size(), maxDepth, values, result);
+    return result;
+}
+
+/*
+ * Function to run the program under another arithmetic policy, always in the interpreter
+ * result is only set when the status is EVAL_OK. Folding keeps the code exact for every policy, see fold().
+ */
+template <class A>
+EvalStatus Program::run_as(const int* values, typename A::value_type& result) const {
+    return run_code<A>(code.data(), code.size(), maxDepth, values, result);
+}
+
+template EvalStatus Program::run_as<Int32Arithmetic>(const int*, int32_t&) const;
+template EvalStatus Program::run_as<Int64Arithmetic>(const int*, int64_t&) const;
+template EvalStatus Program::run_as<CheckedInt32Arithmetic>(const int*, int32_t&) const;
+template EvalStatus Program::run_as<DoubleArithmetic>(const int*, double&) const;
+
+// Publishes native code for this program, a concurrent caller that loses the race frees its copy
+void Program::compileNative() const {
+    JitFunction* f = JitFunction::compile(code);
+    JitFunction* expected = nullptr;
+    if (f && !native.compare_exchange_strong(expected, f, memory_order_acq_rel)) {
+        delete f;
+    }
+}
+
+/*
+ * Function to run bytecode given the value of every variable, indexed by symbol id
+ * depth is the deepest the operand stack gets. Stores the value left on top of the operand stack in result.
+ * One instantiation per policy, so the operators are resolved at compile time and policies that cannot fail have
+ * no status checks. Static so that code that is not owned by a Program, like a mapped snapshot, runs the same way.
+ */
+template <class A>
+EvalStatus Program::run_code(const Instruction* instructions, size_t length, int depth,
+                             const int* values, typename A::value_type& result) {
+    typedef typename A::value_type T;
+    T fixedStack[FIXED_STACK_SIZE];
+    T* operands = fixedStack;
+    if (depth > FIXED_STACK_SIZE) {
+        static thread_local vector<T> deepStack;
+        if ((int)deepStack.size() < depth) {
+            deepStack.resize(depth);
+        }
+        operands = &deepStack[0];
+    }
+    
+    int top = -1;
+    const Instruction* pc = instructions;
+    const Instruction* end = pc + length;
+    for (; pc != end; pc++) {
+        switch (pc->op) {
+            case PUSH_CONST:
+                operands[++top] = pc->operand;
+                break;
+            case LOAD_SLOT:
+                operands[++top] = values[pc->operand];
+                break;
+            default: {
+                top--;
+                EvalStatus status = applyOperator<A>(pc->op, operands[top], operands[top + 1], operands[top]);
+                if (status != EVAL_OK) {return status;}
+                break;
+            }
+        }
+    }
+    result = operands[top];
+    return EVAL_OK;
+}
+
+template EvalStatus Program::run_code<Int32Arithmetic>(const Instruction*, size_t, int, const int*, int32_t&);
+template EvalStatus Program::run_code<Int64Arithmetic>(const Instruction*, size_t, int, const int*, int64_t&);
+template EvalStatus Program::run_code<CheckedInt32Arithmetic>(const Instruction*, size_t, int, const int*, int32_t&);
+template EvalStatus Program::run_code<DoubleArithmetic>(const Instruction*, size_t, int, const int*, double&);
+
+const pmr::vector<Instruction>& Program::get_code() const {
+    return code;
+}
+
+const pmr::vector<int>& Program::get_variables() const {
+    return variables;
+}
+
+int Program::get_max_depth() const {
+    return maxDepth;
+}
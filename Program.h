@@ -0,0 +1,83 @@
+/* 
+ * File:   Program.h
+ * Author: John Shelnutt
+ * Synopsis: Header file for the compiled form of an arithmetic expression - a flat bytecode array that is built once from the postfix tokens and then evaluated many times
+ */
+
+#ifndef PROGRAM_H
+#define PROGRAM_H
+
+#include <string>
+#include <vector>
+#include <string_view>
+#include <memory_resource>
+#include <atomic>
+#include "Token.h"
+#include "SymbolTable.h"
+#include "Jit.h"
+#include "Numeric.h"
+using namespace std;
+
+enum Opcode {PUSH_CONST, LOAD_SLOT, ADD, SUB, MUL, DIV, MOD};
+
+struct Instruction {
+    Opcode op;
+    int operand; // decoded literal for PUSH_CONST, symbol id for LOAD_SLOT, unused for operators
+};
+
+// Applies one operator under arithmetic policy A, see Numeric.h
+template <class A>
+inline EvalStatus applyOperator(Opcode op, typename A::value_type a, typename A::value_type b, typename A::value_type& r) {
+    switch (op) {
+        case ADD:
+            return A::add(a, b, r);
+        case SUB:
+            return A::sub(a, b, r);
+        case MUL:
+            return A::mul(a, b, r);
+        case DIV:
+            return A::div(a, b, r);
+        default:
+            return A::mod(a, b, r);
+    }
+}
+
+class Program {
+public:
+    Program(pmr::memory_resource* resource = pmr::get_default_resource());
+    Program(const Program& p);
+    Program(Program&& p);
+    ~Program();
+    Program& operator=(const Program& p);
+    Program& operator=(Program&& p);
+    static void set_jit_threshold(unsigned evaluations);
+    void compile(const pmr::vector<Token>& postfix, string_view source, SymbolTable& symbols);
+    void clear();
+    void shrink();
+    void remap(const vector<int>& ids);
+    void load(const Instruction* instructions, size_t length, const int* ids, size_t count);
+    int run(const int* values) const;
+    template <class A> EvalStatus run_as(const int* values, typename A::value_type& result) const;
+    template <class A> static EvalStatus run_code(const Instruction* instructions, size_t length, int depth,
+                                                  const int* values, typename A::value_type& result);
+    const pmr::vector<Instruction>& get_code() const;
+    const pmr::vector<int>& get_variables() const;
+    int get_max_depth() const;
+private:
+    pmr::vector<Instruction> code;
+    pmr::vector<int> variables; // distinct symbol ids of the variables in the source expression, sorted
+    int maxDepth;         // deepest the operand stack gets while running code
+    
+    // Native code tier, compiled once a program has been run jitThreshold times
+    mutable atomic<unsigned> evaluations;
+    mutable atomic<JitFunction*> native;
+    
+    // Helper functions
+    void fold();
+    void measureDepth();
+    void compileNative() const;
+};
+
+int evaluate(int a, int b, Opcode op);
+
+#endif /* PROGRAM_H */
@@ -0,0 +1,216 @@
+/* 
+ * File:   Scan.cpp
+ * Author: John Shelnutt
+ * Synopsis: Implements the block classifier and separator search in scalar code, SSE2 and AVX2
+ */
+
+#include "Scan.h"
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define CALCULATOR_SCAN_X86
+#endif
+using namespace std;
+
+// Byte classes for the scalar version, one flag bit per mask of BlockMasks, none for other bytes
+enum Scan_flag {SCAN_SPACE = 1, SCAN_SPECIAL = 2, SCAN_ALPHA = 4, SCAN_DIGIT = 8};
+
+struct ScanTable {
+    unsigned char flags[256];
+    
+    constexpr ScanTable() : flags() {
+        for (int c = 0; c < 256; c++) {
+            flags[c] = 0;
+        }
+        for (int c = 'a'; c <= 'z'; c++) {
+            flags[c] = SCAN_ALPHA;
+            flags[c - 'a' + 'A'] = SCAN_ALPHA;
+        }
+        for (int c = '0'; c <= '9'; c++) {
+            flags[c] = SCAN_DIGIT;
+        }
+        flags[(unsigned char)' '] = SCAN_SPACE;
+        const char* special = "+-*/%=()";
+        for (const char* p = special; *p; p++) {
+            flags[(unsigned char)*p] = SCAN_SPECIAL;
+        }
+    }
+};
+
+constexpr ScanTable scanTable; // built by the compiler, so it is filled in before any scanning can happen
+
+// Bit 0 of each of the 8 bytes of word, packed into 8 bits by one multiplication (the products cannot overlap)
+inline uint64_t packBytes(uint64_t word) {
+    return ((word & 0x0101010101010101ULL) * 0x0102040810204080ULL) >> 56;
+}
+
+// 8 bytes at a time: their flags are put side by side in a word, and every class is packed out of it
+void classifyScalar(const unsigned char* s, size_t length, BlockMasks& m) {
+    m.space = m.special = m.alpha = m.digit = 0;
+    for (size_t group = 0; group < (length + 7) / 8; group++) {
+        uint64_t word = 0;
+        for (size_t j = 0; j < 8; j++) {
+            word |= (uint64_t)scanTable.flags[s[8 * group + j]] << (8 * j);
+        }
+        size_t shift = 8 * group;
+        m.space |= packBytes(word) << shift;
+        m.special |= packBytes(word >> 1) << shift;
+        m.alpha |= packBytes(word >> 2) << shift;
+        m.digit |= packBytes(word >> 3) << shift;
+    }
+}
+
+size_t findSeparatorScalar(const char* s, size_t begin, size_t end) {
+    for (size_t i = begin; i < end; i++) {
+        if (s[i] == ';' || s[i] == '\n') {return i;}
+    }
+    return end;
+}
+
+#ifdef CALCULATOR_SCAN_X86
+
+/*
+ * 16 bytes at a time with SSE2, which every x86-64 CPU has
+ * Ranges are tested as (c - low) <= span unsigned, through min_epu8; letters are folded to lower case first.
+ */
+void classifySse2(const unsigned char* s, size_t length, BlockMasks& m) {
+    m.space = m.special = m.alpha = m.digit = 0;
+    for (size_t part = 0; part < (length + 15) / 16; part++) {
+        __m128i c = _mm_loadu_si128((const __m128i*)(s + 16 * part));
+        __m128i special = _mm_or_si128(_mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(c, _mm_set1_epi8('+')), _mm_cmpeq_epi8(c, _mm_set1_epi8('-'))),
+                                                    _mm_or_si128(_mm_cmpeq_epi8(c, _mm_set1_epi8('*')), _mm_cmpeq_epi8(c, _mm_set1_epi8('/')))),
+                                       _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(c, _mm_set1_epi8('%')), _mm_cmpeq_epi8(c, _mm_set1_epi8('='))),
+                                                    _mm_or_si128(_mm_cmpeq_epi8(c, _mm_set1_epi8('(')), _mm_cmpeq_epi8(c, _mm_set1_epi8(')')))));
+        __m128i digit = _mm_sub_epi8(c, _mm_set1_epi8('0'));
+        digit = _mm_cmpeq_epi8(_mm_min_epu8(digit, _mm_set1_epi8(9)), digit);
+        __m128i alpha = _mm_sub_epi8(_mm_or_si128(c, _mm_set1_epi8(0x20)), _mm_set1_epi8('a'));
+        alpha = _mm_cmpeq_epi8(_mm_min_epu8(alpha, _mm_set1_epi8(25)), alpha);
+        size_t shift = 16 * part;
+        m.space |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(c, _mm_set1_epi8(' '))) << shift;
+        m.special |= (uint64_t)(uint16_t)_mm_movemask_epi8(special) << shift;
+        m.digit |= (uint64_t)(uint16_t)_mm_movemask_epi8(digit) << shift;
+        m.alpha |= (uint64_t)(uint16_t)_mm_movemask_epi8(alpha) << shift;
+    }
+}
+
+size_t findSeparatorSse2(const char* s, size_t begin, size_t end) {
+    size_t i = begin;
+    for (; i + 16 <= end; i += 16) {
+        __m128i c = _mm_loadu_si128((const __m128i*)(s + i));
+        int found = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(c, _mm_set1_epi8(';')), _mm_cmpeq_epi8(c, _mm_set1_epi8('\n'))));
+        if (found) {return i + __builtin_ctz(found);}
+    }
+    return findSeparatorScalar(s, i, end);
+}
+
+// The same as the SSE2 versions, 32 bytes at a time
+__attribute__((target("avx2")))
+void classifyAvx2(const unsigned char* s, size_t length, BlockMasks& m) {
+    m.space = m.special = m.alpha = m.digit = 0;
+    for (size_t part = 0; part < (length + 31) / 32; part++) {
+        __m256i c = _mm256_loadu_si256((const __m256i*)(s + 32 * part));
+        __m256i special = _mm256_or_si256(_mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(c, _mm256_set1_epi8('+')), _mm256_cmpeq_epi8(c, _mm256_set1_epi8('-'))),
+                                                          _mm256_or_si256(_mm256_cmpeq_epi8(c, _mm256_set1_epi8('*')), _mm256_cmpeq_epi8(c, _mm256_set1_epi8('/')))),
+                                          _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(c, _mm256_set1_epi8('%')), _mm256_cmpeq_epi8(c, _mm256_set1_epi8('='))),
+                                                          _mm256_or_si256(_mm256_cmpeq_epi8(c, _mm256_set1_epi8('(')), _mm256_cmpeq_epi8(c, _mm256_set1_epi8(')')))));
+        __m256i digit = _mm256_sub_epi8(c, _mm256_set1_epi8('0'));
+        digit = _mm256_cmpeq_epi8(_mm256_min_epu8(digit, _mm256_set1_epi8(9)), digit);
+        __m256i alpha = _mm256_sub_epi8(_mm256_or_si256(c, _mm256_set1_epi8(0x20)), _mm256_set1_epi8('a'));
+        alpha = _mm256_cmpeq_epi8(_mm256_min_epu8(alpha, _mm256_set1_epi8(25)), alpha);
+        size_t shift = 32 * part;
+        m.space |= (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(c, _mm256_set1_epi8(' '))) << shift;
+        m.special |= (uint64_t)(uint32_t)_mm256_movemask_epi8(special) << shift;
+        m.digit |= (uint64_t)(uint32_t)_mm256_movemask_epi8(digit) << shift;
+        m.alpha |= (uint64_t)(uint32_t)_mm256_movemask_epi8(alpha) << shift;
+    }
+}
+
+__attribute__((target("avx2")))
+size_t findSeparatorAvx2(const char* s, size_t begin, size_t end) {
+    size_t i = begin;
+    for (; i + 32 <= end; i += 32) {
+        __m256i c = _mm256_loadu_si256((const __m256i*)(s + i));
+        uint32_t found = (uint32_t)_mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(c, _mm256_set1_epi8(';')),
+                                                                        _mm256_cmpeq_epi8(c, _mm256_set1_epi8('\n'))));
+        if (found) {return i + __builtin_ctz(found);}
+    }
+    return findSeparatorSse2(s, i, end);
+}
+
+#endif
+
+void classifyFirst(const unsigned char* s, size_t length, BlockMasks& m);
+size_t findSeparatorFirst(const char* s, size_t begin, size_t end);
+
+// Constant initialized, so they are right even for scanning during another file's static initialization
+ScanFunctions scanFunctions = {classifyFirst, findSeparatorFirst};
+ScanLevel scanLevel = SCAN_SCALAR;
+bool scanLevelSet = false; // setScanLevel was called, the level is not picked automatically any more
+
+// The widest implementation this CPU runs
+ScanLevel detectScanLevel() {
+#ifdef CALCULATOR_SCAN_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {return SCAN_AVX2;}
+    return SCAN_SSE2;
+#else
+    return SCAN_SCALAR;
+#endif
+}
+
+/*
+ * Switches to level, or to the widest one the CPU supports if it is lower, and returns the level in use
+ * Only meant to be called while nothing is being scanned, e.g. at startup or between benchmark runs.
+ */
+ScanLevel setScanLevel(ScanLevel level) {
+    ScanLevel supported = detectScanLevel();
+    if (level > supported) {level = supported;}
+    scanLevel = level;
+    scanLevelSet = true;
+#ifdef CALCULATOR_SCAN_X86
+    if (level == SCAN_AVX2) {
+        scanFunctions.classify = classifyAvx2;
+        scanFunctions.findSeparator = findSeparatorAvx2;
+        return level;
+    } else if (level == SCAN_SSE2) {
+        scanFunctions.classify = classifySse2;
+        scanFunctions.findSeparator = findSeparatorSse2;
+        return level;
+    }
+#endif
+    scanFunctions.classify = classifyScalar;
+    scanFunctions.findSeparator = findSeparatorScalar;
+    return level;
+}
+
+// Switches to the widest level once, the first time anything scans or asks for the level, unless one was set before
+void chooseScanLevel() {
+    static const ScanLevel chosen = scanLevelSet ? scanLevel : setScanLevel(SCAN_AVX2); // initialized once, thread safe
+    (void)chosen;
+}
+
+// What scanFunctions start with: they choose the level, which replaces them, and scan with what it chose
+void classifyFirst(const unsigned char* s, size_t length, BlockMasks& m) {
+    chooseScanLevel();
+    scanFunctions.classify(s, length, m);
+}
+
+size_t findSeparatorFirst(const char* s, size_t begin, size_t end) {
+    chooseScanLevel();
+    return scanFunctions.findSeparator(s, begin, end);
+}
+
+ScanLevel getScanLevel() {
+    chooseScanLevel();
+    return scanLevel;
+}
+
+const char* scanLevelName(ScanLevel level) {
+    switch (level) {
+        case SCAN_AVX2:
+            return "avx2";
+        case SCAN_SSE2:
+            return "sse2";
+        default:
+            return "scalar";
+    }
+}
@@ -0,0 +1,67 @@
+/* 
+ * File:   Scan.h
+ * Author: John Shelnutt
+ * Synopsis: Header file for the vectorized scanners - character classification of 64 byte blocks into bitmasks and the search for expression separators, with the widest implementation the CPU supports chosen at run time
+ */
+
+#ifndef SCAN_H
+#define SCAN_H
+
+#include <cstddef>
+#include <cstring>
+#include <cstdint>
+using namespace std;
+
+const size_t SCAN_BLOCK = 64;
+
+/*
+ * Classes of up to 64 bytes, bit b for byte b
+ * special is every single character token: + - * / % = ( ). Bytes in none of the masks are other; bits past the end
+ * of a short block are clear in valid and in every class.
+ */
+struct BlockMasks {
+    uint64_t valid;
+    uint64_t space;
+    uint64_t special;
+    uint64_t alpha;
+    uint64_t digit;
+};
+
+enum ScanLevel {SCAN_SCALAR, SCAN_SSE2, SCAN_AVX2};
+
+// Implementations in use, set by setScanLevel, or to the widest the CPU supports by the first scan before it is called
+struct ScanFunctions {
+    void (*classify)(const unsigned char* s, size_t length, BlockMasks& masks);   // see classifyBlock, valid is left to it
+    size_t (*findSeparator)(const char* s, size_t begin, size_t end);
+};
+
+extern ScanFunctions scanFunctions;
+
+ScanLevel detectScanLevel();
+ScanLevel setScanLevel(ScanLevel level);
+ScanLevel getScanLevel();
+const char* scanLevelName(ScanLevel level);
+
+/*
+ * Classifies the length <= SCAN_BLOCK bytes at s
+ * A short block is copied, so nothing past its end is read; the implementations may read it up to the next multiple of
+ * their vector width, and skip the vectors past it.
+ */
+inline void classifyBlock(const unsigned char* s, size_t length, BlockMasks& masks) {
+    if (length == SCAN_BLOCK) {
+        scanFunctions.classify(s, length, masks);
+        masks.valid = ~0ULL;
+        return;
+    }
+    unsigned char block[SCAN_BLOCK] = {}; // a zero byte is in no class
+    memcpy(block, s, length);
+    scanFunctions.classify(block, length, masks);
+    masks.valid = (1ULL << length) - 1;
+}
+
+// Offset of the first ; or line break in [begin, end), end if there is none
+inline size_t findSeparator(const char* s, size_t begin, size_t end) {
+    return scanFunctions.findSeparator(s, begin, end);
+}
+
+#endif /* SCAN_H */
@@ -0,0 +1,533 @@
+/* 
+ * File:   Server.cpp
+ * Author: John Shelnutt
+ * Synopsis: Implements the calculator server's event loop and request handling, and a client that pipelines its input to a server
+ */
+
+#include "Server.h"
+#include "Stats.h"
+#include <iostream>
+#include <algorithm>
+#include <sstream>
+#include <cstring>
+#ifdef __linux__
+#include <cerrno>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+using namespace std;
+
+// Replies a connection may have waiting before the server stops reading its requests, until the client reads them
+const size_t OUTPUT_LIMIT = 1 << 20;
+
+// Bytes read from one connection per event, so a client streaming requests cannot starve the others
+const size_t READ_LIMIT = 1 << 20;
+
+// Longest request the server accepts, a longer one closes the connection
+const size_t REQUEST_LIMIT = 64 << 20;
+
+#ifdef __linux__
+
+// Fills in the address of the socket at path, false if the path is too long for one
+bool socketAddress(const string& path, sockaddr_un& address) {
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(address.sun_path)) {return false;}
+    memcpy(address.sun_path, path.c_str(), path.size() + 1);
+    return true;
+}
+
+CalculatorServer::CalculatorServer(const Session& settings) : settings(settings) {
+    listenFd = -1;
+    epollFd = epoll_create1(EPOLL_CLOEXEC);
+    stopFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (epollFd != -1 && stopFd != -1) {
+        epoll_event e;
+        e.events = EPOLLIN;
+        e.data.fd = stopFd;
+        epoll_ctl(epollFd, EPOLL_CTL_ADD, stopFd, &e);
+    }
+}
+
+CalculatorServer::~CalculatorServer() {
+    while (!connections.empty()) {
+        closeConnection(connections.begin()->first);
+    }
+    if (listenFd != -1) {
+        close(listenFd);
+        unlink(socketPath.c_str());
+    }
+    if (stopFd != -1) {close(stopFd);}
+    if (epollFd != -1) {close(epollFd);}
+}
+
+/*
+ * Function to start listening on a Unix domain socket at path, a socket file left behind by an earlier server is replaced
+ * Returns false if the socket cannot be created
+ */
+bool CalculatorServer::listen(const string& path) {
+    sockaddr_un address;
+    if (epollFd == -1 || stopFd == -1 || listenFd != -1 || !socketAddress(path, address)) {return false;}
+    
+    listenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (listenFd == -1) {return false;}
+    unlink(path.c_str());
+    epoll_event e;
+    e.events = EPOLLIN;
+    e.data.fd = listenFd;
+    if (bind(listenFd, (sockaddr*)&address, sizeof(address)) != 0 || ::listen(listenFd, SOMAXCONN) != 0
+        || epoll_ctl(epollFd, EPOLL_CTL_ADD, listenFd, &e) != 0) {
+        close(listenFd);
+        listenFd = -1;
+        return false;
+    }
+    socketPath = path;
+    return true;
+}
+
+// Async-signal-safe, makes run() return
+void CalculatorServer::stop() {
+    uint64_t one = 1;
+    ssize_t written = write(stopFd, &one, sizeof(one));
+    (void)written;
+}
+
+/*
+ * Function to serve clients until stop() is called
+ * One thread does everything: the sessions are only ever touched between epoll_wait calls, so they need no locks.
+ */
+void CalculatorServer::run() {
+    const int MAX_EVENTS = 256;
+    epoll_event events[MAX_EVENTS];
+    while (true) {
+        int ready = epoll_wait(epollFd, events, MAX_EVENTS, -1);
+        if (ready < 0) {
+            if (errno == EINTR) {continue;}
+            return;
+        }
+        for (int i = 0; i < ready; i++) {
+            int fd = events[i].data.fd;
+            if (fd == stopFd) {
+                uint64_t count;
+                ssize_t got = read(stopFd, &count, sizeof(count));
+                (void)got;
+                return;
+            } else if (fd == listenFd) {
+                acceptConnections();
+            } else {
+                unordered_map<int, unique_ptr<Connection> >::iterator it = connections.find(fd);
+                if (it != connections.end()) {
+                    handleEvent(*it->second, events[i].events);
+                }
+            }
+        }
+    }
+}
+
+void CalculatorServer::acceptConnections() {
+    while (true) {
+        int fd = accept4(listenFd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd == -1) {return;} // EAGAIN once every pending connection is taken, or out of descriptors
+    
+        unique_ptr<Connection> c(new Connection());
+        c->fd = fd;
+        c->sent = 0;
+        c->scanned = 0;
+        c->own.reset(newSession());
+        c->session = c->own.get();
+        c->peerClosed = false;
+        c->closing = false;
+        c->events = EPOLLIN;
+        epoll_event e;
+        e.events = c->events;
+        e.data.fd = fd;
+        if (epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &e) != 0) {
+            close(fd);
+            continue;
+        }
+        connections[fd] = move(c);
+    }
+}
+
+/*
+ * A session with the server's settings, except that int32 arithmetic is checked: a client's 5/(a-a) must get
+ * "division by zero" back instead of bringing the server and every other connection down with SIGFPE. int64 has no
+ * checked policy, so main refuses to serve it rather than narrowing it to 32 bits.
+ */
+Session* CalculatorServer::newSession() const {
+    Session* s = new Session();
+    s->copy_settings(settings);
+    if (s->get_arithmetic() == ARITHMETIC_INT32) {
+        s->set_arithmetic(ARITHMETIC_CHECKED);
+    }
+    return s;
+}
+
+void CalculatorServer::closeConnection(int fd) {
+    epoll_ctl(epollFd, EPOLL_CTL_DEL, fd, nullptr);
+    close(fd);
+    connections.erase(fd);
+}
+
+// Reads, answers and writes as far as the connection allows, and closes it once it is done
+void CalculatorServer::handleEvent(Connection& c, uint32_t events) {
+    int fd = c.fd;
+    if ((events & (EPOLLIN | EPOLLHUP | EPOLLERR)) && !readInput(c)) {
+        closeConnection(fd);
+        return;
+    }
+    // Answering stops at OUTPUT_LIMIT, so answer again as long as writing makes room for requests that are waiting
+    do {
+        processInput(c);
+        if (!writeOutput(c)) {
+            closeConnection(fd);
+            return;
+        }
+    } while (!c.closing && c.output.size() - c.sent < OUTPUT_LIMIT
+             && (findLineBreak(c, 0) != string::npos || (c.peerClosed && !c.input.empty())));
+    
+    if ((c.closing || (c.peerClosed && c.input.empty())) && c.sent == c.output.size()) {
+        closeConnection(fd);
+        return;
+    }
+    updateEvents(c);
+}
+
+// Returns false if the connection failed or sent a request that is too long
+bool CalculatorServer::readInput(Connection& c) {
+    if (c.peerClosed || c.closing) {return true;}
+    char buffer[1 << 16];
+    size_t total = 0;
+    while (total < READ_LIMIT) {
+        ssize_t n = read(c.fd, buffer, sizeof(buffer));
+        if (n > 0) {
+            c.input.append(buffer, (size_t)n);
+            total += (size_t)n;
+        } else if (n == 0) {
+            c.peerClosed = true;
+            break;
+        } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            break;
+        } else if (errno != EINTR) {
+            return false;
+        }
+    }
+    return c.input.size() <= REQUEST_LIMIT || findLineBreak(c, 0) != string::npos;
+}
+
+/*
+ * Function to find the first line break of c's input at or after start, string::npos if there is none
+ * Bytes that were searched before are skipped, so a long request arriving in many reads is only searched once.
+ */
+size_t CalculatorServer::findLineBreak(Connection& c, size_t start) {
+    size_t from = max(start, c.scanned);
+    const char* found = from < c.input.size() ? (const char*)memchr(c.input.data() + from, '\n', c.input.size() - from) : nullptr;
+    if (!found) {
+        c.scanned = c.input.size();
+        return string::npos;
+    }
+    c.scanned = (size_t)(found - c.input.data());
+    return c.scanned;
+}
+
+/*
+ * Function to answer every whole request received so far, in order
+ * Stops while OUTPUT_LIMIT bytes of replies are waiting, the rest is answered once the client has read them.
+ * A last request without a line break is answered when the client closes its side.
+ */
+void CalculatorServer::processInput(Connection& c) {
+    size_t start = 0;
+    while (!c.closing && c.output.size() - c.sent < OUTPUT_LIMIT) {
+        size_t end = findLineBreak(c, start);
+        if (end == string::npos) {
+            if (c.peerClosed && start < c.input.size()) {
+                handleRequest(c, string_view(c.input).substr(start));
+                start = c.input.size();
+            }
+            break;
+        }
+        handleRequest(c, string_view(c.input).substr(start, end - start));
+        start = end + 1;
+    }
+    c.input.erase(0, start);
+    c.scanned = c.scanned > start ? c.scanned - start : 0;
+    if (c.closing) {
+        c.input.clear();
+        c.scanned = 0;
+    }
+}
+
+void CalculatorServer::handleRequest(Connection& c, string_view request) {
+    if (!request.empty() && request.back() == '\r') {
+        request.remove_suffix(1);
+    }
+    if (request.empty()) {return;}
+    
+    char action = request[0];
+    string_view argument = request.substr(1);
+    if (!argument.empty() && argument[0] == ' ') {
+        argument.remove_prefix(1);
+    }
+    
+    OutputBuffer buffer(c.output);
+    TextSink out(buffer);
+    if (action == 'c' || action == 'C' || action == 's' || action == 'S') {
+        STATS_PHASE(PHASE_ADD_EXPRESSIONS);
+        if (action == 's' || action == 'S') {
+            c.session->reset();
+        }
+        c.session->addExpressions(string(argument));
+    } else if (action == '=' || action == '<' || action == '>' || action == 'f' || action == 'F') {
+        STATS_PHASE(PHASE_ACTION);
+        c.session->runAction(action, out);
+    } else if (action == 't' || action == 'T') {
+        ostringstream stats;
+        printStats(stats);
+        buffer.write(stats.str());
+    } else if (action == 'u' || action == 'U') {
+        if (argument.empty()) {
+            c.session = c.own.get();
+        } else {
+            unique_ptr<Session>& named = sessions[string(argument)];
+            if (!named) {
+                named.reset(newSession());
+            }
+            c.session = named.get();
+        }
+    } else if (action == 'e' || action == 'E') {
+        c.session->set_environment(argument.empty() ? nullptr : &environments.get(string(argument)));
+    } else if (action == 'q' || action == 'Q') {
+        c.closing = true;
+    } else {
+        buffer.write("error: unknown request ", 23);
+        buffer.write(request);
+        buffer.put('\n');
+    }
+    c.output.push_back('\n');
+}
+
+// Sends as much of the waiting output as the socket takes, returns false if the connection failed
+bool CalculatorServer::writeOutput(Connection& c) {
+    while (c.sent < c.output.size()) {
+        ssize_t n = send(c.fd, c.output.data() + c.sent, c.output.size() - c.sent, MSG_NOSIGNAL);
+        if (n > 0) {
+            c.sent += (size_t)n;
+        } else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            break;
+        } else if (n < 0 && errno == EINTR) {
+            continue;
+        } else {
+            return false;
+        }
+    }
+    if (c.sent == c.output.size()) {
+        c.output.clear();
+        c.sent = 0;
+    } else if (c.sent > OUTPUT_LIMIT) {
+        c.output.erase(0, c.sent);
+        c.sent = 0;
+    }
+    return true;
+}
+
+// Watches for input only while the client is not behind on reading replies, and for output while replies are waiting
+void CalculatorServer::updateEvents(Connection& c) {
+    uint32_t events = 0;
+    if (!c.peerClosed && !c.closing && c.output.size() - c.sent < OUTPUT_LIMIT) {
+        events |= EPOLLIN;
+    }
+    if (c.sent < c.output.size()) {
+        events |= EPOLLOUT;
+    }
+    if (events != c.events) {
+        epoll_event e;
+        e.events = events;
+        e.data.fd = c.fd;
+        epoll_ctl(epollFd, EPOLL_CTL_MOD, c.fd, &e);
+        c.events = events;
+    }
+}
+
+// Opens a blocking connection to the server at path, -1 if there is none
+int connectServer(const string& path) {
+    sockaddr_un address;
+    if (!socketAddress(path, address)) {return -1;}
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd == -1) {return -1;}
+    if (connect(fd, (sockaddr*)&address, sizeof(address)) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Writes all of data to fd, false on error
+bool writeAll(int fd, const char* data, size_t length) {
+    while (length > 0) {
+        ssize_t n = write(fd, data, length);
+        if (n < 0 && errno == EINTR) {continue;}
+        if (n <= 0) {return false;}
+        data += n;
+        length -= (size_t)n;
+    }
+    return true;
+}
+
+// The line of input being split into requests, the way processInput and handleRequest split them
+struct RequestLine {
+    size_t length;
+    char first;
+    char last;
+};
+
+/*
+ * Function to count the requests in the length bytes at data, continuing line
+ * Returns how many of the bytes to send: everything up to and including a q request, which sets quit because the
+ * server answers nothing after it.
+ */
+size_t countRequests(const char* data, size_t length, RequestLine& line, size_t& requests, bool& quit) {
+    for (size_t i = 0; i < length; i++) {
+        if (data[i] != '\n') {
+            line.first = line.length == 0 ? data[i] : line.first;
+            line.last = data[i];
+            line.length++;
+            continue;
+        }
+        if (line.length > (line.last == '\r' ? 1u : 0u)) {
+            requests++;
+            quit = line.first == 'q' || line.first == 'Q';
+        }
+        line.length = 0;
+        if (quit) {return i + 1;}
+    }
+    return length;
+}
+
+/*
+ * Function to send everything read from inputFd to the server at path and copy the replies to outputFd
+ * Requests are sent as soon as they are read, without waiting for the replies to the ones before them.
+ * Returns the exit status: 0 once the server has answered every request and closed the connection, 1 on errors,
+ * including a server that goes away before answering all of them.
+ */
+int runClient(const string& path, int inputFd, int outputFd) {
+    int fd = connectServer(path);
+    if (fd == -1) {
+        cerr << "cannot connect to " << path << endl;
+        return 1;
+    }
+    
+    string pending;
+    size_t sent = 0;
+    bool inputDone = false;
+    bool shutDown = false;
+    RequestLine line = {0, 0, 0};
+    size_t requests = 0;
+    size_t replies = 0;   // every reply ends with an empty line, and no line of one is empty
+    char previous = '\n';
+    bool quit = false;
+    char buffer[1 << 16];
+    while (true) {
+        pollfd fds[2];
+        fds[0].fd = fd;
+        fds[0].events = POLLIN | (sent < pending.size() ? POLLOUT : 0);
+        fds[1].fd = inputFd;
+        fds[1].events = !inputDone && pending.size() - sent < OUTPUT_LIMIT ? POLLIN : 0;
+        if (poll(fds, inputDone ? 1 : 2, -1) < 0) {
+            if (errno == EINTR) {continue;}
+            break;
+        }
+    
+        if (!inputDone && (fds[1].revents & (POLLIN | POLLHUP | POLLERR))) {
+            ssize_t n = read(inputFd, buffer, sizeof(buffer));
+            if (n > 0) {
+                pending.append(buffer, countRequests(buffer, (size_t)n, line, requests, quit));
+                inputDone = quit;
+            } else if (n == 0 || errno != EINTR) {
+                if (line.length > (line.last == '\r' ? 1u : 0u)) {
+                    requests++; // the server answers a last line without a line break too
+                }
+                inputDone = true;
+            }
+        }
+        if (fds[0].revents & POLLOUT) {
+            ssize_t n = send(fd, pending.data() + sent, pending.size() - sent, MSG_NOSIGNAL | MSG_DONTWAIT);
+            if (n > 0) {
+                sent += (size_t)n;
+            } else if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                break;
+            }
+            if (sent == pending.size()) {
+                pending.clear();
+                sent = 0;
+            }
+        }
+        if (inputDone && sent == pending.size() && !shutDown) {
+            shutdown(fd, SHUT_WR); // the server answers what it has and closes
+            shutDown = true;
+        }
+        if (fds[0].revents & (POLLIN | POLLHUP | POLLERR)) {
+            ssize_t n = recv(fd, buffer, sizeof(buffer), MSG_DONTWAIT);
+            if (n > 0) {
+                for (ssize_t i = 0; i < n; i++) {
+                    replies += buffer[i] == '\n' && previous == '\n';
+                    previous = buffer[i];
+                }
+                if (!writeAll(outputFd, buffer, (size_t)n)) {break;}
+            } else if (n == 0) {
+                close(fd);
+                if (replies < requests) {
+                    cerr << "connection to " << path << " closed with " << requests - replies
+                         << " requests unanswered" << endl;
+                    return 1;
+                }
+                return 0;
+            } else if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                break;
+            }
+        }
+    }
+    cerr << "connection to " << path << " failed: " << strerror(errno) << endl;
+    close(fd);
+    return 1;
+}
+
+#else
+
+CalculatorServer::CalculatorServer(const Session& settings) : settings(settings) {
+    listenFd = -1;
+    epollFd = -1;
+    stopFd = -1;
+}
+
+CalculatorServer::~CalculatorServer() {
+}
+
+bool CalculatorServer::listen(const string& path) {
+    (void)path;
+    return false;
+}
+
+void CalculatorServer::run() {
+}
+
+void CalculatorServer::stop() {
+}
+
+int connectServer(const string& path) {
+    (void)path;
+    return -1;
+}
+
+int runClient(const string& path, int inputFd, int outputFd) {
+    (void)inputFd;
+    (void)outputFd;
+    cerr << "cannot connect to " << path << ": the server needs Linux" << endl;
+    return 1;
+}
+
+#endif
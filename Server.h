@@ -0,0 +1,84 @@
+/* 
+ * File:   Server.h
+ * Author: John Shelnutt
+ * Synopsis: Header file for the calculator server - sessions kept resident behind a Unix domain socket, served by one epoll event loop, and the client that talks to it
+ */
+
+#ifndef SERVER_H
+#define SERVER_H
+
+#include <string>
+#include <string_view>
+#include <memory>
+#include <unordered_map>
+#include "Session.h"
+#include "Environment.h"
+using namespace std;
+
+/*
+ * Every session the server creates copies the settings it was started with, except that int32 arithmetic is checked
+ * instead: a division by zero would otherwise take the whole server down with every client's sessions. For the same
+ * reason the server does not run with int64 arithmetic, which has no checked form.
+ * Protocol: every request is one line, an action character optionally followed by a space and its argument
+ *   c EXPRESSIONS   add ;-separated expressions (the c command)
+ *   s EXPRESSIONS   start over, then add them (the s command)
+ *   = < > f         print the results, postfix, prefix or parenthesized forms
+ *   t               print the phase statistics
+ *   u NAME          switch to the named session NAME, shared by every connection; u alone goes back to the
+ *                   connection's own session, which is where every connection starts
+ *   e NAME          keep the current session's variables in the environment NAME, shared with every session attached
+ *                   to it; e alone goes back to the session's own variables. Either drops the session's expressions.
+ *   q               close the connection once the replies before it are sent
+ * Every reply is the lines the action prints, possibly none, followed by an empty line. Requests can be pipelined:
+ * a client may send any number of them without waiting, replies come back in request order.
+ */
+class CalculatorServer {
+public:
+    CalculatorServer(const Session& settings);
+    ~CalculatorServer();
+    bool listen(const string& path);
+    void run();
+    void stop();
+private:
+    CalculatorServer(const CalculatorServer&) = delete;
+    CalculatorServer& operator=(const CalculatorServer&) = delete;
+
+    struct Connection {
+        int fd;
+        string input;          // received bytes that do not make a whole request yet, or wait for output to drain
+        size_t scanned;        // input before this offset has no line break left in it
+        string output;         // replies not sent yet, from sent on
+        size_t sent;
+        unique_ptr<Session> own;
+        Session* session;      // own or a named session
+        bool peerClosed;       // the client will not send anything more
+        bool closing;          // a q request was handled, nothing after it is
+        uint32_t events;       // what epoll currently watches for
+    };
+
+    const Session& settings;  // every new session copies its settings
+    string socketPath;
+    int listenFd;
+    int epollFd;
+    int stopFd;               // eventfd that stop() writes to, so it also works from a signal handler
+    unordered_map<int, unique_ptr<Connection> > connections;
+    unordered_map<string, unique_ptr<Session> > sessions;
+    EnvironmentStore environments;
+
+    // Helper functions
+    void acceptConnections();
+    void handleEvent(Connection& c, uint32_t events);
+    bool readInput(Connection& c);
+    void processInput(Connection& c);
+    size_t findLineBreak(Connection& c, size_t start);
+    void handleRequest(Connection& c, string_view request);
+    bool writeOutput(Connection& c);
+    void updateEvents(Connection& c);
+    void closeConnection(int fd);
+    Session* newSession() const;
+};
+
+int connectServer(const string& path);
+int runClient(const string& path, int inputFd, int outputFd);
+
+#endif /* SERVER_H */
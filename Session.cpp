@@ -0,0 +1,527 @@
+/* 
+ * File:   Session.cpp
+ * Author: John Shelnutt
+ * Synopsis: Implements the calculator actions on a session - adding ;-separated expressions, evaluating them and printing their prefix, postfix and parenthesized forms
+ */
+
+#include "Session.h"
+#include "Ingest.h"
+#include "Snapshot.h"
+#include <type_traits>
+using namespace std;
+
+// Sequences shorter than this are evaluated on the calling thread, waking the pool costs more than it saves
+const size_t PARALLEL_THRESHOLD = 4096;
+
+// First block of the expression arena, big enough that short sequences never reach the allocator
+const size_t EXPRESSION_BLOCK = 64 << 10;
+
+Session::Session() : expressionBlock(new char[EXPRESSION_BLOCK]), expressionArena(expressionBlock.get(), EXPRESSION_BLOCK),
+                     expSequence(&expressionArena), variables(&symbolArena), dependents(&expressionArena),
+                     results(&expressionArena), stale(&expressionArena), staleList(&expressionArena), dag(&expressionArena) {
+    compactExpressions = false;
+    threadCount = 0;
+    arithmetic = ARITHMETIC_INT32;
+    environment = nullptr;
+    sharedSubexpressions = false;
+    dagArithmetic = ARITHMETIC_INT32;
+}
+
+// Applies an assignment to symbols, returns false if the variable already had that value
+bool Session::updateLookupTable(const Expression& e, SymbolTable& symbols) {
+    // expression e is of the form "a = b", tokenized array is {a, =, b}, where a is the variable name and b is the variable value
+    const Token& name = e.get_tokenized()[0];
+    int id = symbols.intern(e.get_source().data() + name.get_offset(), name.get_length());
+    int value = e.get_tokenized()[2].value();
+    
+    // a later assignment replaces the value, only the expressions reading this variable have to be evaluated again
+    if (symbols.is_defined(id) && symbols.get_value(id) == value) {return false;}
+    symbols.define(id, value);
+    if (!environment && id < (int)dependents.size()) {
+        for (size_t i : dependents[id]) {
+            markStale(i);
+        }
+    }
+    if (sharedSubexpressions && !environment) {
+        dag.variableChanged(id);
+    }
+    return true;
+}
+
+void Session::markStale(size_t index) {
+    if (!stale[index]) {
+        stale[index] = 1;
+        staleList.push_back(index);
+    }
+}
+
+// Recomputes every stale result, on the pool when there are enough of them
+void Session::refreshResults() const {
+    if (staleList.empty()) {return;}
+    
+    if (threadCount != 1 && staleList.size() >= PARALLEL_THRESHOLD) {
+        evaluateExpressions(expSequence, staleList, variables, results, getPool());
+    } else {
+        for (size_t i : staleList) {
+            results[i] = evaluateOne(expSequence[i], variables);
+        }
+    }
+    for (size_t i : staleList) {
+        stale[i] = 0;
+    }
+    staleList.clear();
+}
+
+// helper function for debugging - prints all the stored variable names and values
+void Session::printLookupTable(ostream& out) const {
+    out << "contents of the variable look up table: " << endl;
+    for (int id = 0; id < (int)variables.size(); id++) {
+        if (variables.is_defined(id)) {
+            out << variables.get_name(id) << " => " << variables.get_value(id) << endl;
+        }
+    }
+}
+
+// Start over - wipes the expression sequence and every variable
+void Session::reset() {
+    clearExpressions();
+    parseCache.clear();
+    variables.clear();
+    symbolArena.release();
+}
+
+// Drops the expressions but keeps the variables they defined
+void Session::clearExpressions() {
+    // every container lets go of its storage first, then the arena takes all of it back at once
+    expSequence = pmr::vector<Expression>(&expressionArena);
+    dependents = pmr::vector<pmr::vector<size_t> >(&expressionArena);
+    results = pmr::vector<EvalResult>(&expressionArena);
+    stale = pmr::vector<char>(&expressionArena);
+    staleList = pmr::vector<size_t>(&expressionArena);
+    dag.clear();
+    expressionArena.release();
+}
+
+void Session::set_compact(bool compact) {
+    compactExpressions = compact;
+}
+
+ThreadPool& Session::getPool() const {
+    if (!pool) {
+        pool.reset(new ThreadPool(threadCount));
+    }
+    return *pool;
+}
+
+void Session::set_threads(unsigned threads) {
+    if (threads != threadCount) {
+        pool.reset();
+    }
+    threadCount = threads;
+}
+
+/*
+ * Arithmetic the = action uses. 32-bit wrapping arithmetic is the default and the only one with cached results and
+ * native code, the others evaluate every expression each time it is printed.
+ */
+void Session::set_arithmetic(Arithmetic a) {
+    arithmetic = a;
+}
+
+Arithmetic Session::get_arithmetic() const {
+    return arithmetic;
+}
+
+/*
+ * Shares the variables of e from now on, nullptr goes back to the session's own
+ * Expressions are compiled against one table of symbols, so the sequence is dropped when this changes.
+ */
+void Session::set_environment(Environment* e) {
+    if (e == environment) {return;}
+    clearExpressions();
+    environment = e;
+}
+
+Environment* Session::get_environment() const {
+    return environment;
+}
+
+/*
+ * Evaluates through one graph of the distinct subexpressions of the sequence, see ExpressionDag.h, instead of every
+ * expression on its own. Pays off when the sequence repeats subexpressions, otherwise the bookkeeping can make = slightly
+ * slower. The graph is dropped when this is turned off.
+ */
+void Session::set_shared_subexpressions(bool shared) {
+    sharedSubexpressions = shared;
+    if (!shared) {
+        dag.clear();
+    }
+}
+
+// Takes over every set_ option of s, not its expressions or variables
+void Session::copy_settings(const Session& s) {
+    set_compact(s.compactExpressions);
+    set_threads(s.threadCount);
+    set_parse_cache_limit(s.parseCache.get_memory_limit());
+    set_arithmetic(s.arithmetic);
+    set_shared_subexpressions(s.sharedSubexpressions);
+}
+
+const pmr::vector<Expression>& Session::get_expressions() const {
+    return expSequence;
+}
+
+const SymbolTable& Session::get_variables() const {
+    return variables;
+}
+
+// Bytes of compiled forms kept for repeated expression texts, 0 parses every expression from scratch
+void Session::set_parse_cache_limit(size_t bytes) {
+    parseCache.set_memory_limit(bytes);
+}
+
+const ParseCache& Session::get_parse_cache() const {
+    return parseCache;
+}
+
+// The shared subexpression graph as of the last =, empty unless they are turned on
+bool Session::get_shared_subexpressions() const {
+    return sharedSubexpressions;
+}
+
+const ExpressionDag& Session::get_dag() const {
+    return dag;
+}
+
+// Runs one of the printing actions (=, <, >, f/F) over the whole sequence
+void Session::runAction(char action, OutputSink& out) const {
+    if (action == '=') {
+        printResult(out);
+    } else if (action == '>') {
+        printPrefix(out);
+    } else if (action == '<') {
+        printPostfix(out);
+    } else if (action == 'f' || action == 'F') {
+        printParenthesized(out);
+    }
+}
+
+// Results against an environment are not cached, every = evaluates against the version current when it starts
+void Session::printResult(OutputSink& out) const {
+    EpochGuard guard;
+    const SymbolTable& symbols = environment ? environment->get_current().symbols : variables;
+    if (sharedSubexpressions) {
+        if (arithmetic == ARITHMETIC_INT64) {
+            printSharedResultAs<Int64Arithmetic>(out, symbols);
+        } else if (arithmetic == ARITHMETIC_CHECKED) {
+            printSharedResultAs<CheckedInt32Arithmetic>(out, symbols);
+        } else if (arithmetic == ARITHMETIC_DOUBLE) {
+            printSharedResultAs<DoubleArithmetic>(out, symbols);
+        } else {
+            printSharedResultAs<Int32Arithmetic>(out, symbols);
+        }
+        return;
+    }
+    if (arithmetic == ARITHMETIC_INT64) {
+        printResultAs<Int64Arithmetic>(out, symbols);
+        return;
+    } else if (arithmetic == ARITHMETIC_CHECKED) {
+        printResultAs<CheckedInt32Arithmetic>(out, symbols);
+        return;
+    } else if (arithmetic == ARITHMETIC_DOUBLE) {
+        printResultAs<DoubleArithmetic>(out, symbols);
+        return;
+    } else if (environment) {
+        printResultAs<Int32Arithmetic>(out, symbols);
+        return;
+    }
+    
+    refreshResults();
+    for (size_t i = 0; i < expSequence.size(); i++) {
+        const Expression& e = expSequence[i];
+        if (!results[i].evaluated) {
+            out.result(e.get_original(), e.get_exp_type(), e.is_arithmetic() ? OUTPUT_UNDEFINED : OUTPUT_NOT_ARITHMETIC, (int64_t)0);
+        } else {
+            out.result(e.get_original(), e.get_exp_type(), OUTPUT_OK, (int64_t)results[i].value);
+        }
+    }
+}
+
+// Prints the result of e, or why there is none: it is not arithmetic, reads an undefined variable or status is an error
+template <class T>
+void printEvaluated(OutputSink& out, const Expression& e, bool defined, EvalStatus status, T value) {
+    OutputError error = outputError(status);
+    if (!defined) {
+        error = e.is_arithmetic() ? OUTPUT_UNDEFINED : OUTPUT_NOT_ARITHMETIC;
+    }
+    if (is_same<T, double>::value) {
+        out.result(e.get_original(), e.get_exp_type(), error, (double)value);
+    } else {
+        out.result(e.get_original(), e.get_exp_type(), error, (int64_t)value);
+    }
+}
+
+// printResult under arithmetic policy A, errors the policy reports are printed after the expression
+template <class A>
+void Session::printResultAs(OutputSink& out, const SymbolTable& symbols) const {
+    for (const Expression& e : expSequence) {
+        bool defined = e.is_arithmetic();
+        for (size_t v = 0; defined && v < e.get_variables().size(); v++) {
+            defined = symbols.is_defined(e.get_variables()[v]);
+        }
+        typename A::value_type value = 0;
+        EvalStatus status = defined ? e.get_result_as<A>(symbols, value) : EVAL_OK;
+        printEvaluated(out, e, defined, status, value);
+    }
+}
+
+/*
+ * printResultAs through the shared subexpression graph: the expressions added since the last = join the graph, and
+ * only the values that changed since then are computed again.
+ */
+template <class A>
+void Session::printSharedResultAs(OutputSink& out, const SymbolTable& symbols) const {
+    while (dag.size() < expSequence.size()) {
+        dag.add(expSequence[dag.size()]);
+    }
+    if (environment) {
+        reportEnvironmentChanges(symbols);
+    }
+    if (dagArithmetic != arithmetic) {
+        dag.invalidate();
+        dagArithmetic = arithmetic;
+    }
+    dag.evaluate<A>(symbols);
+    for (size_t i = 0; i < expSequence.size(); i++) {
+        bool defined = dag.is_defined(i);
+        typename A::value_type value = 0;
+        EvalStatus status = defined ? dag.get_result<A>(i, value) : EVAL_OK;
+        printEvaluated(out, expSequence[i], defined, status, value);
+    }
+}
+
+/*
+ * The variables of an environment change without the session hearing of it, any session attached to it can assign
+ * them. So the graph is told about the ones that differ from the version it read last time, which is one comparison
+ * per variable instead of computing every node again.
+ */
+void Session::reportEnvironmentChanges(const SymbolTable& symbols) const {
+    size_t n = symbols.size();
+    dagValues.resize(n, 0);
+    dagDefined.resize(n, 0);
+    for (size_t id = 0; id < n; id++) {
+        bool defined = symbols.is_defined((int)id);
+        int value = defined ? symbols.get_value((int)id) : 0;
+        if (defined != (dagDefined[id] != 0) || value != dagValues[id]) {
+            dag.variableChanged((int)id);
+            dagDefined[id] = defined;
+            dagValues[id] = value;
+        }
+    }
+}
+
+void Session::printPrefix(OutputSink& out) const {
+    for (const Expression& e : expSequence) {
+        out.form(FORM_PREFIX, e.get_original(), e.get_exp_type(), e.is_arithmetic() ? e.get_prefix() : string());
+    }
+}
+
+void Session::printPostfix(OutputSink& out) const {
+    for (const Expression& e : expSequence) {
+        out.form(FORM_POSTFIX, e.get_original(), e.get_exp_type(), e.is_arithmetic() ? e.get_postfix_string() : string());
+    }
+}
+
+void Session::printParenthesized(OutputSink& out) const {
+    for (const Expression& e : expSequence) {
+        out.form(FORM_PARENTHESIZED, e.get_original(), e.get_exp_type(), e.is_arithmetic() ? e.get_parenthesized() : string());
+    }
+}
+
+/*
+ * Breaks up input into sequence of expressions, adding assignment values to the variable look up table in order
+ * With an environment, all of s is parsed against a copy of its current version, which is published as one new version.
+ */
+void Session::addExpressions(const string& s) {
+    if (!environment) {
+        addSequence(s, variables);
+        return;
+    }
+    environment->update([&](SymbolTable& symbols) {
+        size_t names = symbols.size();
+        bool assigned = addSequence(s, symbols);
+        return assigned || symbols.size() != names;
+    });
+}
+
+// Returns true if an assignment changed a value in symbols
+bool Session::addSequence(const string& s, SymbolTable& symbols) {
+    bool assigned = false;
+    size_t start = 0;
+    size_t nextExpBreak = s.find(';');
+    while (nextExpBreak != string::npos) {
+        assigned |= addExpression(s.substr(start, nextExpBreak - start), symbols);
+        start = nextExpBreak + 1;
+        nextExpBreak = s.find(';', start);
+    }
+    
+    // A semicolon at the very end does not start another statement
+    if (start == 0 || start != s.length()) {
+        assigned |= addExpression(s.substr(start), symbols);
+    }
+    return assigned;
+}
+
+/*
+ * Expressions come from the parse cache, or straight from the expression arena when the cache is off or the symbols
+ * are an environment's, which the cached forms were not compiled against
+ */
+bool Session::addExpression(const string& s, SymbolTable& symbols) {
+    if (parseCache.get_memory_limit() != 0 && !environment) {
+        expSequence.push_back(Expression(s, symbols, parseCache));
+    } else {
+        expSequence.push_back(Expression(s, symbols, &expressionArena));
+    }
+    results.push_back(EvalResult());
+    stale.push_back(0);
+    return registerExpression(expSequence.size() - 1, symbols);
+}
+
+/*
+ * Sets up the cached result and dependencies of a newly added expression and applies it if it is an assignment
+ * Returns true if it was an assignment that changed a value
+ */
+bool Session::registerExpression(size_t index, SymbolTable& symbols) {
+    Expression& e = expSequence[index];
+    bool assigned = false;
+    if (!environment) {
+        markStale(index);
+        addDependencies(index);
+    }
+    
+    // Add assignment value to look up table (if expression is an assignment statement)
+    if (e.is_assignment()) {
+        assigned = updateLookupTable(e, symbols);
+    }
+    if (compactExpressions) {
+        e.compact();
+    }
+    return assigned;
+}
+
+void Session::addDependencies(size_t index) {
+    const Expression& e = expSequence[index];
+    if (e.is_arithmetic()) {
+        for (int id : e.get_variables()) {
+            if (id >= (int)dependents.size()) {
+                dependents.resize(variables.size());
+            }
+            dependents[id].push_back(index);
+        }
+    }
+}
+
+// Expressions per parsing task when loading a file, every task interns into its own symbol table
+const size_t PARSE_CHUNK = 1 << 14;
+
+/*
+ * Function to load a whole file of expressions separated by ; or line breaks
+ * The file is memory mapped, split and parsed in parallel into preallocated slots of the sequence. Every parsing task
+ * uses its own symbol table, which is merged into the session's afterwards; assignments are then applied in file order.
+ * A session attached to an environment goes back to its own variables first. Returns false if the file cannot be read.
+ */
+bool Session::loadFile(const string& path) {
+    MappedFile file;
+    if (!file.open(path)) {return false;}
+    set_environment(nullptr);
+    
+    ThreadPool& workers = getPool();
+    vector<Span> spans;
+    splitExpressions(file.data(), file.size(), workers, spans);
+    
+    size_t first = expSequence.size();
+    size_t chunks = (spans.size() + PARSE_CHUNK - 1) / PARSE_CHUNK;
+    expSequence.resize(first + spans.size());
+    vector<SymbolTable> localSymbols(chunks);
+    
+    workers.run(chunks, [&](size_t c) {
+        size_t end = (c + 1) * PARSE_CHUNK < spans.size() ? (c + 1) * PARSE_CHUNK : spans.size();
+        for (size_t i = c * PARSE_CHUNK; i < end; i++) {
+            expSequence[first + i].set(string(file.data() + spans[i].start, spans[i].length), localSymbols[c]);
+        }
+    });
+    
+    for (size_t c = 0; c < chunks; c++) {
+        vector<int> ids(localSymbols[c].size());
+        for (size_t id = 0; id < ids.size(); id++) {
+            ids[id] = variables.intern(localSymbols[c].get_name((int)id));
+        }
+        size_t end = (c + 1) * PARSE_CHUNK < spans.size() ? (c + 1) * PARSE_CHUNK : spans.size();
+        for (size_t i = c * PARSE_CHUNK; i < end; i++) {
+            expSequence[first + i].remap_variables(ids);
+        }
+    }
+    
+    // The loaded expressions are all stale, so assignments only have to reach the dependents that were there before
+    results.resize(expSequence.size());
+    stale.resize(expSequence.size(), 0);
+    for (size_t i = first; i < expSequence.size(); i++) {
+        markStale(i);
+        if (expSequence[i].is_assignment()) {
+            updateLookupTable(expSequence[i], variables);
+        }
+    }
+    for (size_t i = first; i < expSequence.size(); i++) {
+        addDependencies(i);
+        if (compactExpressions) {
+            expSequence[i].compact();
+        }
+    }
+    return true;
+}
+
+// Writes the sequence and the variables to a snapshot file, see Snapshot.h
+bool Session::saveSnapshot(const string& path) const {
+    EpochGuard guard;
+    return writeSnapshot(expSequence, environment ? environment->get_current().symbols : variables, path);
+}
+
+/*
+ * Function to replace the session with the one saved in a snapshot file
+ * Symbols are interned in their saved order, so the saved programs keep their ids and nothing is parsed; every
+ * expression is compacted. Returns false if the file is not a readable snapshot; the session is left as it was,
+ * or empty if the symbols turn out to be damaged. A damaged expression record is parsed from its text instead.
+ * A session attached to an environment goes back to its own variables.
+ */
+bool Session::loadSnapshot(const string& path) {
+    SnapshotView view;
+    if (!view.open(path)) {return false;}
+    
+    set_environment(nullptr);
+    reset();
+    for (int id = 0; id < (int)view.get_symbol_count(); id++) {
+        string_view name = view.get_name(id);
+        if (variables.intern(name.data(), name.size()) != id) { // a repeated name, the saved ids cannot be kept
+            reset();
+            return false;
+        }
+        if (view.is_defined(id)) {
+            variables.define(id, view.get_value(id));
+        }
+    }
+    
+    expSequence.reserve(view.size());
+    for (size_t i = 0; i < view.size(); i++) {
+        shared_ptr<const CompiledExpression> form = view.get_form(i, &expressionArena);
+        if (form) {
+            expSequence.push_back(Expression(view.get_original(i), form));
+        } else {
+            expSequence.push_back(Expression(string(view.get_original(i)), variables, &expressionArena));
+        }
+        results.push_back(EvalResult());
+        stale.push_back(0);
+        markStale(i);
+        addDependencies(i);
+    }
+    return true;
+}
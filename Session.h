@@ -0,0 +1,104 @@
+/* 
+ * File:   Session.h
+ * Author: John Shelnutt
+ * Synopsis: Header file for a calculator session - the sequence of expressions entered so far together with the variable look up table they are evaluated against
+ */
+
+#ifndef SESSION_H
+#define SESSION_H
+
+#include <string>
+#include <vector>
+#include <iostream>
+#include "Expression.h"
+#include "SymbolTable.h"
+#include "ThreadPool.h"
+#include "ParallelEvaluator.h"
+#include "ParseCache.h"
+#include "Output.h"
+#include "Environment.h"
+#include "ExpressionDag.h"
+#include <memory>
+#include <memory_resource>
+using namespace std;
+
+/*
+ * Everything a session allocates comes from two arenas: the variables from one that lives until reset, the expressions
+ * and their bookkeeping from one that lives until the sequence is cleared. Releasing an arena gives all of it back at once.
+ * A session attached to an Environment keeps its variables there instead: the c and s commands publish their assignments
+ * as a new version, and = evaluates against the version current at the time, so sessions on other threads can share it.
+ */
+class Session {
+public:
+    Session();
+    Session(const Session&) = delete;
+    Session& operator=(const Session&) = delete;
+    void addExpressions(const string& s);
+    bool loadFile(const string& path);
+    bool saveSnapshot(const string& path) const;
+    bool loadSnapshot(const string& path);
+    void reset();
+    void clearExpressions();
+    void set_compact(bool compact);
+    void set_threads(unsigned threads);
+    void set_parse_cache_limit(size_t bytes);
+    void set_arithmetic(Arithmetic a);
+    void set_environment(Environment* e);
+    void set_shared_subexpressions(bool shared);
+    Environment* get_environment() const;
+    Arithmetic get_arithmetic() const;
+    bool get_shared_subexpressions() const;
+    void copy_settings(const Session& s);
+    void runAction(char action, OutputSink& out) const;
+    void printResult(OutputSink& out) const;
+    void printPrefix(OutputSink& out) const;
+    void printPostfix(OutputSink& out) const;
+    void printParenthesized(OutputSink& out) const;
+    void printLookupTable(ostream& out) const;
+    const pmr::vector<Expression>& get_expressions() const;
+    const SymbolTable& get_variables() const;
+    const ParseCache& get_parse_cache() const;
+    const ExpressionDag& get_dag() const;
+private:
+    // Declared first so they outlive everything allocated from them
+    pmr::monotonic_buffer_resource symbolArena;      // storage of variables, released by reset
+    unique_ptr<char[]> expressionBlock;               // first block of expressionArena, reused after every release
+    pmr::monotonic_buffer_resource expressionArena;  // expressions without a cached form and all per expression state, released by clearExpressions
+    ParseCache parseCache;  // compiled forms of recent expression texts, interned into variables
+    
+    pmr::vector<Expression> expSequence;
+    SymbolTable variables;  // variable look up table
+    bool compactExpressions; // keep only the source and compiled form of each expression
+    unsigned threadCount;    // 0 = one per hardware thread, 1 = always evaluate serially
+    Arithmetic arithmetic;   // policy the = action evaluates with, see Numeric.h
+    Environment* environment; // shared variables used instead of variables, nullptr if there are none
+    mutable unique_ptr<ThreadPool> pool;  // created the first time a sequence is big enough to evaluate in parallel
+    
+    // Results are cached per expression and only recomputed when a variable they read changes
+    pmr::vector<pmr::vector<size_t> > dependents;  // expressions reading each variable, indexed by symbol id
+    mutable pmr::vector<EvalResult> results;       // last result of every expression
+    mutable pmr::vector<char> stale;               // results[i] has to be recomputed
+    mutable pmr::vector<size_t> staleList;         // indices with stale set, in the order they went stale
+    
+    // With shared subexpressions, = evaluates the graph instead, which catches up with the sequence on every =
+    bool sharedSubexpressions;
+    mutable ExpressionDag dag;
+    mutable Arithmetic dagArithmetic;  // policy the values in dag were computed with
+    mutable pmr::vector<int> dagValues;     // the environment's variables when dag last read them, by symbol id
+    mutable pmr::vector<char> dagDefined;
+    
+    // Helper functions
+    bool addSequence(const string& s, SymbolTable& symbols);
+    bool addExpression(const string& s, SymbolTable& symbols);
+    bool registerExpression(size_t index, SymbolTable& symbols);
+    void addDependencies(size_t index);
+    ThreadPool& getPool() const;
+    bool updateLookupTable(const Expression& e, SymbolTable& symbols);
+    void markStale(size_t index);
+    void refreshResults() const;
+    template <class A> void printResultAs(OutputSink& out, const SymbolTable& symbols) const;
+    template <class A> void printSharedResultAs(OutputSink& out, const SymbolTable& symbols) const;
+    void reportEnvironmentChanges(const SymbolTable& symbols) const;
+};
+
+#endif /* SESSION_H */
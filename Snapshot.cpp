@@ -0,0 +1,412 @@
+/* 
+ * File:   Snapshot.cpp
+ * Author: John Shelnutt
+ * Synopsis: Writes sessions to snapshot files and reads expressions, symbols and results straight out of a mapped snapshot
+ */
+
+#include "Snapshot.h"
+#include "Parser.h"
+#include <fstream>
+#include <vector>
+#include <cstring>
+using namespace std;
+
+const char SNAPSHOT_MAGIC[8] = {'C', 'A', 'L', 'C', 'S', 'N', 'A', 'P'};
+const uint32_t SNAPSHOT_BYTE_ORDER = 0x01020304;
+
+// FNV-1a over 8 byte words, continued from hash
+uint32_t checksum(const void* data, size_t length, uint32_t hash = 2166136261u) {
+    const unsigned char* bytes = (const unsigned char*)data;
+    uint64_t h = hash;
+    size_t i = 0;
+    for (; i + 8 <= length; i += 8) {
+        uint64_t word;
+        memcpy(&word, bytes + i, sizeof(word));
+        h = (h ^ word) * 1099511628211ull;
+    }
+    for (; i < length; i++) {
+        h = (h ^ bytes[i]) * 1099511628211ull;
+    }
+    return (uint32_t)(h ^ (h >> 32));
+}
+
+// Checksum of an expression record, which must have its checksum field set to 0
+uint32_t expressionChecksum(const SnapshotExpression& r, const Instruction* code, const int32_t* variables, const char* text) {
+    uint32_t hash = checksum(&r, sizeof(r));
+    hash = checksum(code, r.codeLength * sizeof(Instruction), hash);
+    hash = checksum(variables, r.variableCount * sizeof(int32_t), hash);
+    hash = checksum(text + r.sourceOffset, r.sourceLength, hash);
+    if (r.originalOffset != r.sourceOffset) {
+        hash = checksum(text + r.originalOffset, r.originalLength, hash);
+    }
+    return hash;
+}
+
+// Checksum of the header, which must have its checksum field set to 0, and of the symbol sections
+uint32_t symbolChecksum(const SnapshotHeader& h, const SnapshotSymbol* symbols, const int32_t* values, const uint8_t* defined, const char* text) {
+    uint32_t hash = checksum(&h, sizeof(h));
+    hash = checksum(symbols, h.symbolCount * sizeof(SnapshotSymbol), hash);
+    hash = checksum(values, h.symbolCount * sizeof(int32_t), hash);
+    hash = checksum(defined, h.symbolCount, hash);
+    for (uint64_t id = 0; id < h.symbolCount; id++) {
+        hash = checksum(text + symbols[id].nameOffset, symbols[id].nameLength, hash);
+    }
+    return hash;
+}
+
+uint64_t alignSection(uint64_t position) {
+    return (position + 7) & ~uint64_t(7);
+}
+
+// Pads what was written up to position to the next section boundary
+void padSection(ofstream& out, uint64_t& position) {
+    static const char padding[8] = {0};
+    uint64_t end = alignSection(position);
+    out.write(padding, (streamsize)(end - position));
+    position = end;
+}
+
+void writeSection(ofstream& out, const void* data, uint64_t bytes, uint64_t& position) {
+    out.write((const char*)data, (streamsize)bytes);
+    position += bytes;
+    padSection(out, position);
+}
+
+/*
+ * Function to write the expression sequence and the symbol table to a snapshot file at path
+ * Returns false if the file cannot be written
+ */
+bool writeSnapshot(const pmr::vector<Expression>& expressions, const SymbolTable& symbols, const string& path) {
+    size_t symbolCount = symbols.size();
+    string text;
+    vector<SnapshotSymbol> symbolRecords(symbolCount);
+    vector<int32_t> values(symbolCount, 0);
+    vector<uint8_t> defined(symbolCount, 0);
+    for (size_t id = 0; id < symbolCount; id++) {
+        string name = symbols.get_name((int)id);
+        symbolRecords[id].nameOffset = text.size();
+        symbolRecords[id].nameLength = (uint32_t)name.size();
+        symbolRecords[id].reserved = 0;
+        text += name;
+        if (symbols.is_defined((int)id)) {
+            values[id] = symbols.get_value((int)id);
+            defined[id] = 1;
+        }
+    }
+    
+    vector<SnapshotExpression> expressionRecords(expressions.size());
+    uint64_t instructionCount = 0;
+    uint64_t variableCount = 0;
+    for (size_t i = 0; i < expressions.size(); i++) {
+        const Expression& e = expressions[i];
+        SnapshotExpression& r = expressionRecords[i];
+        memset(&r, 0, sizeof(r));
+        r.sourceOffset = text.size();
+        r.sourceLength = (uint32_t)e.get_source().size();
+        text += e.get_source();
+        if (e.get_original() == e.get_source()) {
+            r.originalOffset = r.sourceOffset;
+        } else {
+            r.originalOffset = text.size();
+            text += e.get_original();
+        }
+        r.originalLength = (uint32_t)e.get_original().size();
+        r.codeStart = instructionCount;
+        r.codeLength = (uint32_t)e.get_program().get_code().size();
+        r.variablesStart = variableCount;
+        r.variableCount = (uint32_t)e.get_variables().size();
+        r.maxDepth = e.get_program().get_max_depth();
+        r.type = (uint8_t)(e.is_arithmetic() ? arithmetic : e.is_assignment() ? assignment : illegal);
+        r.valid = r.type != illegal;
+        const pmr::vector<Instruction>& c = e.get_program().get_code();
+        const pmr::vector<int>& v = e.get_variables();
+        r.checksum = expressionChecksum(r, c.data(), v.data(), text.data());
+        instructionCount += r.codeLength;
+        variableCount += r.variableCount;
+    }
+    
+    SnapshotHeader h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, SNAPSHOT_MAGIC, sizeof(h.magic));
+    h.version = SNAPSHOT_VERSION;
+    h.byteOrder = SNAPSHOT_BYTE_ORDER;
+    h.instructionSize = sizeof(Instruction);
+    h.symbolCount = symbolCount;
+    h.expressionCount = expressions.size();
+    h.instructionCount = instructionCount;
+    h.variableCount = variableCount;
+    h.textSize = text.size();
+    h.symbolsOffset = alignSection(sizeof(SnapshotHeader));
+    h.valuesOffset = alignSection(h.symbolsOffset + symbolCount * sizeof(SnapshotSymbol));
+    h.definedOffset = alignSection(h.valuesOffset + symbolCount * sizeof(int32_t));
+    h.expressionsOffset = alignSection(h.definedOffset + symbolCount);
+    h.codeOffset = alignSection(h.expressionsOffset + expressions.size() * sizeof(SnapshotExpression));
+    h.variablesOffset = alignSection(h.codeOffset + instructionCount * sizeof(Instruction));
+    h.textOffset = alignSection(h.variablesOffset + variableCount * sizeof(int32_t));
+    h.fileSize = alignSection(h.textOffset + text.size());
+    h.checksum = symbolChecksum(h, symbolRecords.data(), values.data(), defined.data(), text.data());
+    
+    ofstream out(path.c_str(), ios::binary | ios::trunc);
+    if (!out) {return false;}
+    uint64_t position = 0;
+    writeSection(out, &h, sizeof(h), position);
+    writeSection(out, symbolRecords.data(), symbolCount * sizeof(SnapshotSymbol), position);
+    writeSection(out, values.data(), symbolCount * sizeof(int32_t), position);
+    writeSection(out, defined.data(), symbolCount, position);
+    writeSection(out, expressionRecords.data(), expressionRecords.size() * sizeof(SnapshotExpression), position);
+    for (const Expression& e : expressions) {
+        const pmr::vector<Instruction>& c = e.get_program().get_code();
+        out.write((const char*)c.data(), (streamsize)(c.size() * sizeof(Instruction)));
+    }
+    position += instructionCount * sizeof(Instruction);
+    padSection(out, position);
+    for (const Expression& e : expressions) {
+        const pmr::vector<int>& v = e.get_variables();
+        out.write((const char*)v.data(), (streamsize)(v.size() * sizeof(int32_t)));
+    }
+    position += variableCount * sizeof(int32_t);
+    padSection(out, position);
+    writeSection(out, text.data(), text.size(), position);
+    out.close();
+    return !out.fail();
+}
+
+SnapshotView::SnapshotView() {
+    header = nullptr;
+}
+
+// True if count elements of the given size starting at offset lie inside a file of fileSize bytes
+bool sectionFits(uint64_t offset, uint64_t count, uint64_t elementSize, uint64_t fileSize) {
+    return offset % 8 == 0 && offset <= fileSize && count <= (fileSize - offset) / elementSize;
+}
+
+// True if a text of length bytes at offset lies inside the text section
+bool textFits(uint64_t offset, uint64_t length, uint64_t textSize) {
+    return offset <= textSize && length <= textSize - offset;
+}
+
+/*
+ * Function to map the snapshot at path
+ * Returns false if it cannot be read, is not a snapshot, or was written by another version or kind of machine
+ */
+bool SnapshotView::open(const string& path) {
+    header = nullptr;
+    if (!file.open(path) || file.size() < sizeof(SnapshotHeader)) {return false;}
+    
+    const SnapshotHeader* h = (const SnapshotHeader*)file.data();
+    uint64_t size = file.size();
+    if (memcmp(h->magic, SNAPSHOT_MAGIC, sizeof(h->magic)) != 0 || h->version != SNAPSHOT_VERSION
+        || h->byteOrder != SNAPSHOT_BYTE_ORDER || h->instructionSize != sizeof(Instruction) || h->fileSize != size) {
+        return false;
+    }
+    if (!sectionFits(h->symbolsOffset, h->symbolCount, sizeof(SnapshotSymbol), size)
+        || !sectionFits(h->valuesOffset, h->symbolCount, sizeof(int32_t), size)
+        || !sectionFits(h->definedOffset, h->symbolCount, 1, size)
+        || !sectionFits(h->expressionsOffset, h->expressionCount, sizeof(SnapshotExpression), size)
+        || !sectionFits(h->codeOffset, h->instructionCount, sizeof(Instruction), size)
+        || !sectionFits(h->variablesOffset, h->variableCount, sizeof(int32_t), size)
+        || !sectionFits(h->textOffset, h->textSize, 1, size) || h->symbolCount > INT32_MAX) {
+        return false;
+    }
+    
+    const char* base = file.data();
+    const SnapshotSymbol* names = (const SnapshotSymbol*)(base + h->symbolsOffset);
+    for (uint64_t id = 0; id < h->symbolCount; id++) {
+        if (names[id].nameLength == 0 || !textFits(names[id].nameOffset, names[id].nameLength, h->textSize)) {return false;}
+    }
+    SnapshotHeader unsummed = *h;
+    unsummed.checksum = 0;
+    if (symbolChecksum(unsummed, names, (const int32_t*)(base + h->valuesOffset), (const uint8_t*)(base + h->definedOffset),
+                       base + h->textOffset) != h->checksum) {
+        return false;
+    }
+    
+    symbols = (const SnapshotSymbol*)(base + h->symbolsOffset);
+    values = (const int32_t*)(base + h->valuesOffset);
+    defined = (const uint8_t*)(base + h->definedOffset);
+    expressions = (const SnapshotExpression*)(base + h->expressionsOffset);
+    code = (const Instruction*)(base + h->codeOffset);
+    variables = (const int32_t*)(base + h->variablesOffset);
+    text = base + h->textOffset;
+    checked.reset(new atomic<uint8_t>[h->expressionCount]());
+    header = h;
+    return true;
+}
+
+size_t SnapshotView::size() const {
+    return header ? header->expressionCount : 0;
+}
+
+size_t SnapshotView::get_symbol_count() const {
+    return header ? header->symbolCount : 0;
+}
+
+// Name of symbol id, empty if its record is damaged
+string_view SnapshotView::get_name(int id) const {
+    const SnapshotSymbol& s = symbols[id];
+    if (!textFits(s.nameOffset, s.nameLength, header->textSize)) {return string_view();}
+    return string_view(text + s.nameOffset, s.nameLength);
+}
+
+bool SnapshotView::is_defined(int id) const {
+    return defined[id] != 0;
+}
+
+int SnapshotView::get_value(int id) const {
+    return values[id];
+}
+
+string_view SnapshotView::get_original(size_t i) const {
+    const SnapshotExpression& e = expressions[i];
+    if (!textFits(e.originalOffset, e.originalLength, header->textSize)) {return string_view();}
+    return string_view(text + e.originalOffset, e.originalLength);
+}
+
+string_view SnapshotView::get_source(size_t i) const {
+    const SnapshotExpression& e = expressions[i];
+    if (!textFits(e.sourceOffset, e.sourceLength, header->textSize)) {return string_view();}
+    return string_view(text + e.sourceOffset, e.sourceLength);
+}
+
+bool SnapshotView::is_arithmetic(size_t i) const {
+    return expressions[i].type == arithmetic && checkExpression(i);
+}
+
+// illegal for a damaged record
+Exp_type SnapshotView::get_type(size_t i) const {
+    return checkExpression(i) ? (Exp_type)expressions[i].type : illegal;
+}
+
+// What checkExpression found out about a record, 0 until it is asked
+const uint8_t RECORD_VALID = 1;
+const uint8_t RECORD_DAMAGED = 2;
+
+// verifyExpression, done once per record: every accessor of a record asks, and = asks more than one of them
+bool SnapshotView::checkExpression(size_t i) const {
+    uint8_t state = checked[i].load(memory_order_relaxed);
+    if (state == 0) {
+        state = verifyExpression(i) ? RECORD_VALID : RECORD_DAMAGED;
+        checked[i].store(state, memory_order_relaxed);
+    }
+    return state == RECORD_VALID;
+}
+
+/*
+ * Function to check that record i only points inside the file, matches its checksum, and that its bytecode can run:
+ * known opcodes, symbol ids in range, never popping an empty stack, one value left at the end, and the depth it claims
+ */
+bool SnapshotView::verifyExpression(size_t i) const {
+    const SnapshotExpression& e = expressions[i];
+    if (!textFits(e.sourceOffset, e.sourceLength, header->textSize)
+        || !textFits(e.originalOffset, e.originalLength, header->textSize)
+        || e.codeStart > header->instructionCount || e.codeLength > header->instructionCount - e.codeStart
+        || e.variablesStart > header->variableCount || e.variableCount > header->variableCount - e.variablesStart
+        || e.type > illegal) {
+        return false;
+    }
+    SnapshotExpression unsummed = e;
+    unsummed.checksum = 0;
+    if (expressionChecksum(unsummed, code + e.codeStart, variables + e.variablesStart, text) != e.checksum) {return false;}
+    for (uint32_t v = 0; v < e.variableCount; v++) {
+        if ((uint32_t)variables[e.variablesStart + v] >= header->symbolCount) {return false;}
+    }
+    if (e.codeLength == 0) {return e.type != arithmetic;}
+    
+    int depth = 0;
+    int maxDepth = 0;
+    const Instruction* c = code + e.codeStart;
+    for (uint32_t pc = 0; pc < e.codeLength; pc++) {
+        int32_t op; // read as a number, the file may hold values that are not an Opcode
+        memcpy(&op, &c[pc].op, sizeof(op));
+        if (op == PUSH_CONST) {
+            depth++;
+        } else if (op == LOAD_SLOT) {
+            if ((uint32_t)c[pc].operand >= header->symbolCount) {return false;}
+            depth++;
+        } else if (op >= ADD && op <= MOD && depth >= 2) {
+            depth--;
+        } else {
+            return false;
+        }
+        if (depth > maxDepth) {maxDepth = depth;}
+    }
+    return depth == 1 && maxDepth == e.maxDepth;
+}
+
+/*
+ * Function to evaluate expression i with the values stored in the snapshot, straight from the mapped bytecode
+ * Returns false, like an expression that cannot be evaluated, if it is not arithmetic or reads an undefined variable
+ */
+bool SnapshotView::get_result(size_t i, int& result) const {
+    return get_result_as<Int32Arithmetic>(i, result) == EVAL_OK; // int32 only fails when there is nothing to compute
+}
+
+/*
+ * get_result under arithmetic policy A: EVAL_NOT_ARITHMETIC or EVAL_UNDEFINED if there is no result to compute,
+ * otherwise what the policy reports. result is only set when the status is EVAL_OK.
+ */
+template <class A>
+EvalStatus SnapshotView::get_result_as(size_t i, typename A::value_type& result) const {
+    if (!is_arithmetic(i)) {return EVAL_NOT_ARITHMETIC;}
+    const SnapshotExpression& e = expressions[i];
+    for (uint32_t v = 0; v < e.variableCount; v++) {
+        if (!defined[variables[e.variablesStart + v]]) {return EVAL_UNDEFINED;}
+    }
+    return Program::run_code<A>(code + e.codeStart, e.codeLength, e.maxDepth, values, result);
+}
+
+template EvalStatus SnapshotView::get_result_as<Int32Arithmetic>(size_t, int32_t&) const;
+template EvalStatus SnapshotView::get_result_as<Int64Arithmetic>(size_t, int64_t&) const;
+template EvalStatus SnapshotView::get_result_as<CheckedInt32Arithmetic>(size_t, int32_t&) const;
+template EvalStatus SnapshotView::get_result_as<DoubleArithmetic>(size_t, double&) const;
+
+/*
+ * Prints the same lines as Session::printResult would under the given arithmetic for the session the snapshot was
+ * taken of
+ */
+void SnapshotView::printResult(OutputSink& out, Arithmetic arithmetic) const {
+    if (arithmetic == ARITHMETIC_INT64) {
+        printResultAs<Int64Arithmetic>(out);
+    } else if (arithmetic == ARITHMETIC_CHECKED) {
+        printResultAs<CheckedInt32Arithmetic>(out);
+    } else if (arithmetic == ARITHMETIC_DOUBLE) {
+        printResultAs<DoubleArithmetic>(out);
+    } else {
+        printResultAs<Int32Arithmetic>(out);
+    }
+}
+
+template <class A>
+void SnapshotView::printResultAs(OutputSink& out) const {
+    for (size_t i = 0; i < size(); i++) {
+        typename A::value_type value = 0;
+        OutputError error = outputError(get_result_as<A>(i, value));
+        if (is_same<typename A::value_type, double>::value) {
+            out.result(get_original(i), get_type(i), error, (double)value);
+        } else {
+            out.result(get_original(i), get_type(i), error, (int64_t)value);
+        }
+    }
+}
+
+/*
+ * Function to turn record i back into a compiled form allocated from resource, without parsing its text
+ * The form is compacted: tokens and postfix are re-derived from the source if they are ever asked for.
+ * Returns nullptr if the record is damaged.
+ */
+shared_ptr<const CompiledExpression> SnapshotView::get_form(size_t i, pmr::memory_resource* resource) const {
+    if (!checkExpression(i)) {return nullptr;}
+    const SnapshotExpression& e = expressions[i];
+    shared_ptr<CompiledExpression> form = allocate_shared<CompiledExpression>(pmr::polymorphic_allocator<CompiledExpression>(resource), resource);
+    form->source.assign(text + e.sourceOffset, e.sourceLength);
+    form->program.load(code + e.codeStart, e.codeLength, variables + e.variablesStart, e.variableCount);
+    form->type = (Exp_type)e.type;
+    form->valid = e.valid != 0;
+    form->compacted = true;
+    if (form->type == illegal) {
+        pmr::vector<Token> tokens;
+        pmr::vector<Token> postfix;
+        parseExpression(form->source, tokens, postfix, form->error); // errors are not saved, only illegal forms pay
+    }
+    return form;
+}
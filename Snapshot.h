@@ -0,0 +1,126 @@
+/* 
+ * File:   Snapshot.h
+ * Author: John Shelnutt
+ * Synopsis: Header file for session snapshots - a versioned binary file of the compiled expressions, the symbols and their values that is memory mapped and used in place instead of being parsed again
+ */
+
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <string>
+#include <string_view>
+#include <memory>
+#include <memory_resource>
+#include <atomic>
+#include <iostream>
+#include <cstdint>
+#include "Expression.h"
+#include "Ingest.h"
+#include "Output.h"
+using namespace std;
+
+const uint32_t SNAPSHOT_VERSION = 1;
+
+/*
+ * File layout, every section starts on an 8 byte boundary at the offset the header gives:
+ *   SnapshotHeader
+ *   SnapshotSymbol[symbolCount]          names of the symbols, in id order
+ *   int32_t[symbolCount]                 values
+ *   uint8_t[symbolCount]                 1 if the symbol is defined
+ *   SnapshotExpression[expressionCount]  the sequence, in order
+ *   Instruction[]                        bytecode of every expression back to back
+ *   int32_t[]                            variables of every expression back to back
+ *   char[]                               names and expression texts
+ * Numbers are stored in the byte order of the machine that wrote the file; a file from a machine with another byte
+ * order or Instruction layout is rejected rather than converted. Checksums catch files that were damaged after writing.
+ */
+struct SnapshotHeader {
+    char magic[8];              // "CALCSNAP"
+    uint32_t version;
+    uint32_t byteOrder;         // 0x01020304 as the writer stored it
+    uint32_t instructionSize;   // sizeof(Instruction) of the writer
+    uint32_t checksum;          // of the header with this field 0, the symbol records, values, defined flags and names
+    uint64_t fileSize;
+    uint64_t symbolCount;
+    uint64_t expressionCount;
+    uint64_t instructionCount;
+    uint64_t variableCount;
+    uint64_t textSize;
+    uint64_t symbolsOffset;
+    uint64_t valuesOffset;
+    uint64_t definedOffset;
+    uint64_t expressionsOffset;
+    uint64_t codeOffset;
+    uint64_t variablesOffset;
+    uint64_t textOffset;
+};
+
+struct SnapshotSymbol {
+    uint64_t nameOffset;  // into the text section
+    uint32_t nameLength;
+    uint32_t reserved;
+};
+
+struct SnapshotExpression {
+    uint64_t sourceOffset;    // into the text section
+    uint64_t originalOffset;  // the same as sourceOffset when the text was entered as it is stored
+    uint64_t codeStart;       // first instruction
+    uint64_t variablesStart;  // first variable id
+    uint32_t sourceLength;
+    uint32_t originalLength;
+    uint32_t codeLength;
+    uint32_t variableCount;
+    int32_t maxDepth;
+    uint32_t checksum;        // of the record with this field 0, its code, variables and texts
+    uint8_t type;             // Exp_type
+    uint8_t valid;
+    uint8_t reserved[6];
+};
+
+bool writeSnapshot(const pmr::vector<Expression>& expressions, const SymbolTable& symbols, const string& path);
+
+/*
+ * A snapshot file mapped read-only and used in place
+ * Opening only checks the header and the section bounds and sets aside one byte per expression. Each expression is
+ * checked the first time it is used and the outcome is kept in that byte, a damaged record makes that expression fail
+ * instead of the program.
+ */
+class SnapshotView {
+public:
+    SnapshotView();
+    bool open(const string& path);
+    size_t size() const;
+    size_t get_symbol_count() const;
+    string_view get_name(int id) const;
+    bool is_defined(int id) const;
+    int get_value(int id) const;
+    string_view get_original(size_t i) const;
+    string_view get_source(size_t i) const;
+    bool is_arithmetic(size_t i) const;
+    Exp_type get_type(size_t i) const;
+    bool get_result(size_t i, int& result) const;
+    template <class A> EvalStatus get_result_as(size_t i, typename A::value_type& result) const;
+    void printResult(OutputSink& out, Arithmetic arithmetic = ARITHMETIC_INT32) const;
+    shared_ptr<const CompiledExpression> get_form(size_t i, pmr::memory_resource* resource) const;
+private:
+    SnapshotView(const SnapshotView&) = delete;
+    SnapshotView& operator=(const SnapshotView&) = delete;
+
+    MappedFile file;
+    const SnapshotHeader* header;
+    const SnapshotSymbol* symbols;
+    const int32_t* values;
+    const uint8_t* defined;
+    const SnapshotExpression* expressions;
+    const Instruction* code;
+    const int32_t* variables;
+    const char* text;
+    unique_ptr<atomic<uint8_t>[]> checked; // per expression: 0 not checked yet, else one of the RECORD_ states
+
+    // Helper functions
+    template <class A> void printResultAs(OutputSink& out) const;
+    bool checkExpression(size_t i) const;
+    bool verifyExpression(size_t i) const;
+};
+
+#endif /* SNAPSHOT_H */
@@ -0,0 +1,237 @@
+/* 
+ * File:   Stats.cpp
+ * Author: John Shelnutt
+ * Synopsis: File to implement the per-phase counters and histograms, their text and JSON reports, and the optional hardware counters
+ */
+
+#include "Stats.h"
+
+#ifdef CALCULATOR_STATS
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <cstdio>
+#include <cstring>
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+#endif
+using namespace std;
+
+#ifdef CALCULATOR_STATS
+
+const char* PHASE_NAMES[PHASE_COUNT] = {
+    "parse", "compile", "render", "undefined_check", "get_result",
+    "add_expressions", "action", "load_file"
+};
+
+// Bucket b counts calls that took less than 2^(b+1) ns, the last bucket takes everything longer
+const int HISTOGRAM_BUCKETS = 40;
+
+/*
+ * Counters of one thread
+ * Only the owning thread writes them, so relaxed loads and stores are enough and no cache line is shared between writers.
+ * The atomics only keep the reader that adds them up free of data races.
+ */
+struct PhaseCounters {
+    atomic<uint64_t> calls;
+    atomic<uint64_t> totalNs;
+    atomic<uint64_t> maxNs;
+    atomic<uint64_t> buckets[HISTOGRAM_BUCKETS];
+};
+
+struct ThreadCounters {
+    PhaseCounters phases[PHASE_COUNT];
+};
+
+// Counters of every thread that ever recorded a phase, kept after the thread exits so nothing is lost
+struct Registry {
+    mutex lock;
+    vector<unique_ptr<ThreadCounters> > threads;
+};
+
+Registry& registry() {
+    static Registry r;
+    return r;
+}
+
+ThreadCounters& localCounters() {
+    static thread_local ThreadCounters* local = nullptr;
+    if (!local) {
+        unique_ptr<ThreadCounters> counters(new ThreadCounters());
+        local = counters.get();
+        Registry& r = registry();
+        lock_guard<mutex> guard(r.lock);
+        r.threads.push_back(move(counters));
+    }
+    return *local;
+}
+
+inline void bump(atomic<uint64_t>& counter, uint64_t amount) {
+    counter.store(counter.load(memory_order_relaxed) + amount, memory_order_relaxed);
+}
+
+void recordPhase(Phase phase, uint64_t nanoseconds) {
+    PhaseCounters& c = localCounters().phases[phase];
+    bump(c.calls, 1);
+    bump(c.totalNs, nanoseconds);
+    if (nanoseconds > c.maxNs.load(memory_order_relaxed)) {
+        c.maxNs.store(nanoseconds, memory_order_relaxed);
+    }
+    int bucket = nanoseconds == 0 ? 0 : 63 - __builtin_clzll(nanoseconds);
+    bump(c.buckets[bucket < HISTOGRAM_BUCKETS ? bucket : HISTOGRAM_BUCKETS - 1], 1);
+}
+
+// One phase added up over all threads
+struct PhaseTotals {
+    uint64_t calls;
+    uint64_t totalNs;
+    uint64_t maxNs;
+    uint64_t buckets[HISTOGRAM_BUCKETS];
+};
+
+void collect(PhaseTotals totals[PHASE_COUNT]) {
+    memset(totals, 0, sizeof(PhaseTotals) * PHASE_COUNT);
+    Registry& r = registry();
+    lock_guard<mutex> guard(r.lock);
+    for (const unique_ptr<ThreadCounters>& t : r.threads) {
+        for (int p = 0; p < PHASE_COUNT; p++) {
+            const PhaseCounters& c = t->phases[p];
+            totals[p].calls += c.calls.load(memory_order_relaxed);
+            totals[p].totalNs += c.totalNs.load(memory_order_relaxed);
+            uint64_t maxNs = c.maxNs.load(memory_order_relaxed);
+            if (maxNs > totals[p].maxNs) {totals[p].maxNs = maxNs;}
+            for (int b = 0; b < HISTOGRAM_BUCKETS; b++) {
+                totals[p].buckets[b] += c.buckets[b].load(memory_order_relaxed);
+            }
+        }
+    }
+}
+
+// Upper bound of the bucket the given fraction of calls falls into, in ns, but never more than the slowest call
+uint64_t percentile(const PhaseTotals& t, double fraction) {
+    uint64_t rank = (uint64_t)(t.calls * fraction);
+    uint64_t seen = 0;
+    for (int b = 0; b < HISTOGRAM_BUCKETS; b++) {
+        seen += t.buckets[b];
+        if (seen > rank) {return (uint64_t(1) << (b + 1)) < t.maxNs ? uint64_t(1) << (b + 1) : t.maxNs;}
+    }
+    return t.maxNs;
+}
+
+/*
+ * Hardware counters of the whole process, threads created later included
+ * perf_event_open is Linux only and usually restricted in containers, so every counter is optional
+ */
+const int HARDWARE_COUNTERS = 4;
+const char* HARDWARE_NAMES[HARDWARE_COUNTERS] = {"cycles", "instructions", "cache_references", "cache_misses"};
+int hardwareFds[HARDWARE_COUNTERS] = {-1, -1, -1, -1};
+
+void startHardwareCounters() {
+#ifdef __linux__
+    const uint64_t configs[HARDWARE_COUNTERS] = {
+        PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_CACHE_REFERENCES, PERF_COUNT_HW_CACHE_MISSES
+    };
+    for (int i = 0; i < HARDWARE_COUNTERS; i++) {
+        if (hardwareFds[i] != -1) {continue;}
+        perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = configs[i];
+        attr.inherit = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        hardwareFds[i] = (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+    }
+#endif
+}
+
+// Returns false if the counter could not be opened
+bool readHardwareCounter(int i, uint64_t& value) {
+#ifdef __linux__
+    if (hardwareFds[i] != -1) {
+        return read(hardwareFds[i], &value, sizeof(value)) == (ssize_t)sizeof(value);
+    }
+#endif
+    (void)i;
+    (void)value;
+    return false;
+}
+
+bool statsEnabled() {
+    return true;
+}
+
+void printStats(ostream& out) {
+    PhaseTotals totals[PHASE_COUNT];
+    collect(totals);
+    out << "phase             calls     total ms    mean ns     p50 ns     p99 ns     max ns" << endl;
+    for (int p = 0; p < PHASE_COUNT; p++) {
+        const PhaseTotals& t = totals[p];
+        if (t.calls == 0) {continue;}
+        char line[160];
+        snprintf(line, sizeof(line), "%-15s %9llu %12.3f %10llu %10llu %10llu %10llu", PHASE_NAMES[p],
+                 (unsigned long long)t.calls, t.totalNs / 1e6, (unsigned long long)(t.totalNs / t.calls),
+                 (unsigned long long)percentile(t, 0.5), (unsigned long long)percentile(t, 0.99), (unsigned long long)t.maxNs);
+        out << line << endl;
+    }
+    for (int i = 0; i < HARDWARE_COUNTERS; i++) {
+        uint64_t value;
+        if (readHardwareCounter(i, value)) {
+            out << HARDWARE_NAMES[i] << ": " << value << endl;
+        }
+    }
+}
+
+void writeStatsJson(ostream& out) {
+    PhaseTotals totals[PHASE_COUNT];
+    collect(totals);
+    out << "{\n  \"phases\": {";
+    for (int p = 0; p < PHASE_COUNT; p++) {
+        const PhaseTotals& t = totals[p];
+        out << (p == 0 ? "\n" : ",\n")
+            << "    \"" << PHASE_NAMES[p] << "\": {\"calls\": " << t.calls << ", \"total_ns\": " << t.totalNs
+            << ", \"max_ns\": " << t.maxNs << ", \"p50_ns\": " << (t.calls ? percentile(t, 0.5) : 0)
+            << ", \"p99_ns\": " << (t.calls ? percentile(t, 0.99) : 0) << ", \"histogram\": [";
+        bool first = true;
+        for (int b = 0; b < HISTOGRAM_BUCKETS; b++) {
+            if (t.buckets[b] == 0) {continue;}
+            out << (first ? "" : ", ") << "{\"lt_ns\": " << (uint64_t(1) << (b + 1)) << ", \"calls\": " << t.buckets[b] << "}";
+            first = false;
+        }
+        out << "]}";
+    }
+    out << "\n  },\n  \"hardware\": {";
+    bool first = true;
+    for (int i = 0; i < HARDWARE_COUNTERS; i++) {
+        uint64_t value;
+        if (readHardwareCounter(i, value)) {
+            out << (first ? "" : ", ") << "\"" << HARDWARE_NAMES[i] << "\": " << value;
+            first = false;
+        }
+    }
+    out << "}\n}" << endl;
+}
+
+#else
+
+bool statsEnabled() {
+    return false;
+}
+
+void startHardwareCounters() {
+}
+
+void printStats(ostream& out) {
+    out << "statistics are not compiled in, build with -DCALCULATOR_ENABLE_STATS=ON" << endl;
+}
+
+void writeStatsJson(ostream& out) {
+    out << "{}" << endl;
+}
+
+#endif
@@ -0,0 +1,65 @@
+/* 
+ * File:   Stats.h
+ * Author: John Shelnutt
+ * Synopsis: Header file for the per-phase instrumentation - call counts, total time and latency histograms of every pipeline phase
+ */
+
+#ifndef STATS_H
+#define STATS_H
+
+#include <iostream>
+#include <chrono>
+#include <cstdint>
+using namespace std;
+
+enum Phase {
+    PHASE_PARSE,           // parseExpression: tokenizing, validating and ordering into postfix
+    PHASE_COMPILE,         // Program::compile, folding included
+    PHASE_RENDER,          // prefix, postfix and parenthesized strings
+    PHASE_UNDEFINED_CHECK, // are all variables of an expression defined
+    PHASE_EVALUATE,        // get_result
+    PHASE_ADD_EXPRESSIONS, // the c and s commands, a line in batch mode
+    PHASE_ACTION,          // =, <, > and f
+    PHASE_LOAD_FILE,       // batch mode with --mmap
+    PHASE_COUNT
+};
+
+/*
+ * Everything below costs nothing unless the build defines CALCULATOR_STATS (cmake -DCALCULATOR_ENABLE_STATS=ON)
+ * STATS_PHASE(p) times the rest of the enclosing block as one call of phase p. Every thread records into counters of its
+ * own, which are only added up when they are printed.
+ */
+#ifdef CALCULATOR_STATS
+
+void recordPhase(Phase phase, uint64_t nanoseconds);
+
+class PhaseTimer {
+public:
+    PhaseTimer(Phase phase) : phase(phase), start(chrono::steady_clock::now()) {}
+    ~PhaseTimer() {
+        recordPhase(phase, (uint64_t)chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count());
+    }
+private:
+    PhaseTimer(const PhaseTimer&) = delete;
+    PhaseTimer& operator=(const PhaseTimer&) = delete;
+
+    Phase phase;
+    chrono::steady_clock::time_point start;
+};
+
+#define STATS_CONCAT2(a, b) a##b
+#define STATS_CONCAT(a, b) STATS_CONCAT2(a, b)
+#define STATS_PHASE(phase) PhaseTimer STATS_CONCAT(phaseTimer, __LINE__)(phase)
+
+#else
+
+#define STATS_PHASE(phase) ((void)0)
+
+#endif
+
+bool statsEnabled();
+void startHardwareCounters();
+void printStats(ostream& out);
+void writeStatsJson(ostream& out);
+
+#endif /* STATS_H */
@@ -0,0 +1,121 @@
+/* 
+ * File:   SymbolTable.cpp
+ * Author: John Shelnutt
+ * Synopsis: Implements the interned variable look up table - an open addressing hash from names to ids, a pooled name store, a value array and a defined bitset
+ */
+
+#include "SymbolTable.h"
+#include <cstring>
+using namespace std;
+
+// FNV-1a, identifiers are short so anything fancier does not pay off
+uint32_t hashName(const char* name, size_t length) {
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < length; i++) {
+        h ^= (unsigned char)name[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+// All storage comes from resource, copies of the table use the default resource. Nothing is allocated before the first intern.
+SymbolTable::SymbolTable(pmr::memory_resource* resource) : namePool(resource), nameStart(resource), hashes(resource),
+                                                            buckets(resource), values(resource), defined(resource) {
+}
+
+// Gives all storage back to the memory resource, so an arena behind the table can be released afterwards
+void SymbolTable::clear() {
+    *this = SymbolTable(namePool.get_allocator().resource());
+}
+
+// Returns the id of the name, or -1 if it has never been interned
+int SymbolTable::lookup(const char* name, size_t length, uint32_t hash) const {
+    if (buckets.empty()) {return -1;}
+    size_t mask = buckets.size() - 1;
+    for (size_t b = hash & mask; buckets[b] != -1; b = (b + 1) & mask) {
+        int id = buckets[b];
+        if (hashes[id] == hash && nameStart[id + 1] - nameStart[id] == length
+                && memcmp(&namePool[nameStart[id]], name, length) == 0) {
+            return id;
+        }
+    }
+    return -1;
+}
+
+// Doubles the bucket array once it is half full
+void SymbolTable::grow() {
+    buckets.assign(buckets.size() * 2, -1);
+    size_t mask = buckets.size() - 1;
+    for (size_t id = 0; id < hashes.size(); id++) {
+        size_t b = hashes[id] & mask;
+        while (buckets[b] != -1) {
+            b = (b + 1) & mask;
+        }
+        buckets[b] = (int)id;
+    }
+}
+
+int SymbolTable::intern(const char* name, size_t length) {
+    if (buckets.empty()) {
+        nameStart.assign(1, 0);
+        buckets.assign(16, -1);
+    }
+    uint32_t hash = hashName(name, length);
+    int id = lookup(name, length, hash);
+    if (id != -1) {return id;}
+    
+    id = (int)hashes.size();
+    namePool.insert(namePool.end(), name, name + length);
+    nameStart.push_back((uint32_t)namePool.size());
+    hashes.push_back(hash);
+    values.push_back(0);
+    if (defined.size() * 64 < values.size()) {
+        defined.push_back(0);
+    }
+    
+    if (hashes.size() * 2 > buckets.size()) {
+        grow();
+    } else {
+        size_t mask = buckets.size() - 1;
+        size_t b = hash & mask;
+        while (buckets[b] != -1) {
+            b = (b + 1) & mask;
+        }
+        buckets[b] = id;
+    }
+    return id;
+}
+
+int SymbolTable::intern(const string& name) {
+    return intern(name.data(), name.length());
+}
+
+int SymbolTable::find(const string& name) const {
+    return lookup(name.data(), name.length(), hashName(name.data(), name.length()));
+}
+
+string SymbolTable::get_name(int id) const {
+    return string(namePool.begin() + nameStart[id], namePool.begin() + nameStart[id + 1]);
+}
+
+bool SymbolTable::is_defined(int id) const {
+    return (defined[id >> 6] >> (id & 63)) & 1;
+}
+
+int SymbolTable::get_value(int id) const {
+    return values[id];
+}
+
+// Values indexed by id, undefined variables read as 0
+const int* SymbolTable::get_values() const {
+    return values.data();
+}
+
+void SymbolTable::define(int id, int value) {
+    values[id] = value;
+    defined[id >> 6] |= uint64_t(1) << (id & 63);
+}
+
+size_t SymbolTable::size() const {
+    return hashes.size();
+}
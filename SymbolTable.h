@@ -0,0 +1,42 @@
+/* 
+ * File:   SymbolTable.h
+ * Author: John Shelnutt
+ * Synopsis: Header file for the variable look up table - identifiers are interned to small dense integer ids when an expression is parsed, and values are kept in a contiguous array indexed by those ids
+ */
+
+#ifndef SYMBOLTABLE_H
+#define SYMBOLTABLE_H
+
+#include <string>
+#include <vector>
+#include <memory_resource>
+#include <cstdint>
+using namespace std;
+
+class SymbolTable {
+public:
+    SymbolTable(pmr::memory_resource* resource = pmr::get_default_resource());
+    int intern(const char* name, size_t length);
+    int intern(const string& name);
+    int find(const string& name) const;
+    string get_name(int id) const;
+    bool is_defined(int id) const;
+    int get_value(int id) const;
+    const int* get_values() const;
+    void define(int id, int value);
+    size_t size() const;
+    void clear();
+private:
+    pmr::vector<char> namePool;       // every interned name back to back
+    pmr::vector<uint32_t> nameStart;  // offset of name i in namePool, with one extra entry marking the end
+    pmr::vector<uint32_t> hashes;     // hash of name i, kept so the bucket array can grow without rehashing names
+    pmr::vector<int> buckets;         // open addressing table of ids, -1 marks an empty bucket
+    pmr::vector<int> values;
+    pmr::vector<uint64_t> defined;    // one bit per id
+    
+    // Helper functions
+    int lookup(const char* name, size_t length, uint32_t hash) const;
+    void grow();
+};
+
+#endif /* SYMBOLTABLE_H */
@@ -0,0 +1,125 @@
+/* 
+ * File:   ThreadPool.cpp
+ * Author: John Shelnutt
+ * Synopsis: Implements the work-stealing thread pool - tasks are dealt out in contiguous blocks, owners work through their block front to back and thieves take from the back of someone else's
+ */
+
+#include "ThreadPool.h"
+using namespace std;
+
+// threads = 0 uses every hardware thread
+ThreadPool::ThreadPool(unsigned threadCount) {
+    if (threadCount == 0) {
+        threadCount = thread::hardware_concurrency();
+    }
+    if (threadCount == 0) {threadCount = 1;}
+    
+    current = nullptr;
+    generation = 0;
+    remaining = 0;
+    stopping = false;
+    for (unsigned i = 0; i < threadCount; i++) {
+        workers.push_back(unique_ptr<Worker>(new Worker()));
+    }
+    for (unsigned i = 1; i < threadCount; i++) {
+        threads.push_back(thread(&ThreadPool::workerLoop, this, i));
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        lock_guard<mutex> guard(stateLock);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (thread& t : threads) {
+        t.join();
+    }
+}
+
+unsigned ThreadPool::size() const {
+    return (unsigned)workers.size();
+}
+
+// Pops the next task of the worker's own deque, or steals the last task of another worker's
+bool ThreadPool::take(unsigned index, size_t& task) {
+    {
+        Worker& own = *workers[index];
+        lock_guard<mutex> guard(own.lock);
+        if (!own.tasks.empty()) {
+            task = own.tasks.front();
+            own.tasks.pop_front();
+            return true;
+        }
+    }
+    for (size_t i = 1; i < workers.size(); i++) {
+        Worker& victim = *workers[(index + i) % workers.size()];
+        lock_guard<mutex> guard(victim.lock);
+        if (!victim.tasks.empty()) {
+            task = victim.tasks.back();
+            victim.tasks.pop_back();
+            return true;
+        }
+    }
+    return false;
+}
+
+// Runs tasks until every deque is empty
+void ThreadPool::drain(unsigned index) {
+    size_t task;
+    while (take(index, task)) {
+        (*current)(task);
+        if (--remaining == 0) {
+            lock_guard<mutex> guard(stateLock);
+            done.notify_all();
+        }
+    }
+}
+
+void ThreadPool::workerLoop(unsigned index) {
+    unsigned long long seen = 0;
+    while (true) {
+        {
+            unique_lock<mutex> guard(stateLock);
+            wake.wait(guard, [&]() {return stopping || generation != seen;});
+            if (stopping) {return;}
+            seen = generation;
+        }
+        drain(index);
+    }
+}
+
+/*
+ * Function to run task(i) for every i in [0, count) on the pool, returning once all of them have finished
+ * The calling thread works on the first block itself
+ */
+void ThreadPool::run(size_t count, const function<void(size_t)>& task) {
+    if (count == 0) {return;}
+    
+    // The task has to be published before any index is, a worker can still be looking for work from the last run
+    {
+        lock_guard<mutex> guard(stateLock);
+        current = &task;
+        remaining = count;
+    }
+    
+    size_t perWorker = (count + workers.size() - 1) / workers.size();
+    for (size_t w = 0; w < workers.size(); w++) {
+        lock_guard<mutex> guard(workers[w]->lock);
+        for (size_t i = w * perWorker; i < count && i < (w + 1) * perWorker; i++) {
+            workers[w]->tasks.push_back(i);
+        }
+    }
+    
+    {
+        lock_guard<mutex> guard(stateLock);
+        generation++;
+    }
+    wake.notify_all();
+    
+    drain(0);
+    
+    unique_lock<mutex> guard(stateLock);
+    done.wait(guard, [&]() {return remaining == 0;});
+    current = nullptr;
+}
@@ -0,0 +1,48 @@
+/* 
+ * File:   ThreadPool.h
+ * Author: John Shelnutt
+ * Synopsis: Header file for a work-stealing thread pool - every worker owns a deque of task indices and idle workers steal from the others
+ */
+
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+using namespace std;
+
+class ThreadPool {
+public:
+    explicit ThreadPool(unsigned threads = 0);
+    ~ThreadPool();
+    void run(size_t count, const function<void(size_t)>& task);
+    unsigned size() const;
+private:
+    struct Worker {
+        mutex lock;
+        deque<size_t> tasks;
+    };
+    vector<unique_ptr<Worker> > workers; // worker 0 is the thread that calls run
+    vector<thread> threads;
+    
+    mutex stateLock;
+    condition_variable wake;
+    condition_variable done;
+    const function<void(size_t)>* current; // task of the run in progress
+    unsigned long long generation;         // bumped by every run so sleeping workers know there is new work
+    atomic<size_t> remaining;
+    bool stopping;
+    
+    // Helper functions
+    void workerLoop(unsigned index);
+    void drain(unsigned index);
+    bool take(unsigned index, size_t& task);
+};
+
+#endif /* THREADPOOL_H */
@@ -5,7 +5,6 @@
  */
 
 #include "Token.h"
-#include <sstream>
 #include <iostream>
 using namespace std;
 
@@ -32,82 +31,15 @@ string getStringType(const Token_type t) {
 
 Token::Token() {
     type = INVALID;
-    token = "";
+    offset = 0;
+    length = 0;
     priority = -1;
-}
-
-Token::Token(string s) {
-    set(s);
-}
-
-// Function to determine the type of the token - identifier, integer, operator, equals sign, parenthesis, invalid
-void Token::set(string s) {
-    // valid tokens will have their type changed
-    type = INVALID;
-    token = s;
-    priority = -1;
-    
-    // Find types if string is 1 character
-    if (s.length() == 1) {
-        
-        if (s[0] == '=') {
-            type = EQ;
-        }
-        else if (s[0] == '+' || s[0] == '-') {
-            type = OP;
-            priority = 1;
-        }
-        else if (s[0] == '*' || s[0] == '/' || s[0] == '%') {
-            type = OP;
-            priority = 2;
-        } 
-        else if (s[0] == '(') {
-            type = OpenBrace;
-            priority = 0;
-        }
-        else if (s[0] == ')') {
-            type = CloseBrace;
-            priority = 0;
-        }
-        else if (isalpha(s[0])) {
-            type = ID;
-        }
-        else if (isdigit(s[0]) && s[0] != '0') {
-            type = INT;
-        }        
-    }
-    // Determine if identifier, integer, or invalid - non-alphanumeric chars are invalid at this point
-    else {
-        // Integer token cannot start with 0
-        if (s[0] == '0') {return;}
-        
-        for (int i = 0; i < s.length(); i++) {
-            // function is done if a symbol is found
-            if (!isalpha(s[i]) && !isdigit(s[i])) {
-                return;
-            }  
-            
-            // function is done if the first char is a digit, but not every char is
-            if (isdigit(s[0]) && !isdigit(s[i])) {
-                return;
-            }
-                      
-        }
-        if (isdigit(s[0])) {
-            type = INT;
-        }
-        else {
-            type = ID;
-        }
-    }
+    intValue = 0;
 }
 
 int Token::value() const {
     if (type == INT) {
-        // graded on C++98, stoi() not allowed
-        int intVal;
-        istringstream(token) >> intVal;
-        return intVal;
+        return intValue;
     }
     else if (type == ID) {
         return -1;
@@ -121,16 +53,24 @@ Token_type Token::get_type() const {
     return type;
 }
 
-string Token::get_token() const {
-    return token;
+string Token::get_token(string_view source) const {
+    return string(source.substr(offset, length));
+}
+
+size_t Token::get_offset() const {
+    return offset;
+}
+
+size_t Token::get_length() const {
+    return length;
 }
 
 int Token::get_priority() const {
     return priority;
 }
 
-void Token::display() const {
+void Token::display(string_view source) const {
     cout << "type     = " << getStringType(type) << endl
-         << "token    = " << token << endl
+         << "token    = " << get_token(source) << endl
          << "priority = " << priority << endl;    
 }
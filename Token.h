@@ -2,12 +2,15 @@
  * File:   Token.h
  * Author: John Shelnutt
  * Synopsis: Header file for a token, which is the fundamental building block of expressions in the larger calculator program.
+ *           Tokens do not own their text, they hold an offset/length span into the expression they were read from.
  */
 
 #ifndef TOKEN_H
 #define TOKEN_H
 
 #include <string>
+#include <string_view>
+#include <cstdint>
 using namespace std;
 
 enum Token_type {ID, INT, OP, EQ, OpenBrace, CloseBrace, INVALID};
@@ -15,19 +18,30 @@ enum Token_type {ID, INT, OP, EQ, OpenBrace, CloseBrace, INVALID};
 class Token {
 public:
     Token();
-    Token(string s);
-    void set(string s);
-    void display() const;
+    Token(Token_type type, size_t offset, size_t length, int priority, int value);
+    void display(string_view source) const;
     int value() const;
     Token_type get_type() const;
-    string get_token() const;
+    string get_token(string_view source) const;
+    size_t get_offset() const;
+    size_t get_length() const;
     int get_priority() const;
 private:
-    Token_type type = ID;
-    string token;
+    Token_type type;
+    uint32_t offset;   // first character of the token in the source expression
+    uint32_t length;
     int priority;
+    int intValue;      // decoded once by the lexer for INT tokens
 };
 
+// Tokens are classified by the lexer, which already knows the type, priority and value when it finds the token
+// Inline, so the lexer's state stays in registers across the tokens it makes
+inline Token::Token(Token_type type, size_t offset, size_t length, int priority, int value) {
+    this->type = type;
+    this->offset = (uint32_t)offset;
+    this->length = (uint32_t)length;
+    this->priority = priority;
+    intValue = value;
+}
 
 #endif /* TOKEN_H */
-
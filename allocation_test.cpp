@@ -0,0 +1,101 @@
+/* 
+ * File:   allocation_test.cpp
+ * Author: John Shelnutt
+ * Synopsis: Allocation tests run by ctest - the paths that promise not to touch the heap are run under the counting operator new of AllocationCounter.cpp
+ */
+
+#include "Session.h"
+#include "Output.h"
+#include "Lexer.h"
+#include "AllocationCounter.h"
+#include <cstring>
+#include <iostream>
+#include <string>
+using namespace std;
+
+// Helper functions
+string sequence(int expressions) {
+    string s = "a=3;b=-4;c=7";
+    for (int i = 0; i < expressions; i++) {
+        s += ";a*" + to_string(i + 1) + "+(b-c)*(a%" + to_string(i % 5 + 2) + ")-c/(b+" + to_string(i % 3 + 5) + ")";
+    }
+    return s + ";d;(d+a)";
+}
+
+/*
+ * Tokenizing allocates nothing per token: tokens are spans of the source with their value decoded, so a source ten
+ * thousand times longer costs the same number of allocations, none once the token vector has room
+ */
+bool tokenizeAllocationsConstant() {
+    pmr::vector<Token> tokens;
+    tokens.reserve(250000); // 2.5 tokens per step below
+    unsigned long long counts[3];
+    int lengths[3] = {10, 1000, 100000};
+    for (int i = 0; i < 3; i++) {
+        string source;
+        for (int t = 0; t < lengths[i]; t++) {
+            source += t % 2 ? " + (variable" + to_string(t) + ")" : "12345";
+        }
+        tokens.clear();
+        unsigned long long before = allocationCount();
+        tokenize(source, tokens);
+        counts[i] = allocationCount() - before;
+        cerr << tokens.size() << " tokens: " << counts[i] << " allocations" << endl;
+    }
+    return counts[0] == counts[1] && counts[1] == counts[2];
+}
+
+/*
+ * A steady-state = of an already parsed sequence does not allocate
+ * The first = evaluates every expression and grows the output string, the ones after it run from the same state.
+ */
+bool printResultAllocationFree(Arithmetic arithmetic) {
+    Session session;
+    session.set_threads(1);
+    session.set_arithmetic(arithmetic);
+    session.addExpressions(sequence(500));
+    string text;
+    OutputBuffer output(text);
+    TextSink sink(output);
+    for (int i = 0; i < 3; i++) {
+        text.clear();
+        session.printResult(sink);
+    }
+    
+    unsigned long long before = allocationCount();
+    for (int i = 0; i < 100; i++) {
+        text.clear();
+        session.printResult(sink);
+    }
+    unsigned long long allocations = allocationCount() - before;
+    if (allocations != 0) {
+        cerr << "printResult made " << allocations << " allocations in 100 steady-state runs" << endl;
+        return false;
+    }
+    return true;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc != 2) {
+        cerr << "usage: " << argv[0] << " tokenize|printResult|printResult_int64|printResult_checked|printResult_double" << endl;
+        return 2;
+    }
+    
+    bool passed = false;
+    if (strcmp(argv[1], "tokenize") == 0) {
+        passed = tokenizeAllocationsConstant();
+    } else if (strcmp(argv[1], "printResult") == 0) {
+        passed = printResultAllocationFree(ARITHMETIC_INT32);
+    } else if (strcmp(argv[1], "printResult_int64") == 0) {
+        passed = printResultAllocationFree(ARITHMETIC_INT64);
+    } else if (strcmp(argv[1], "printResult_checked") == 0) {
+        passed = printResultAllocationFree(ARITHMETIC_CHECKED);
+    } else if (strcmp(argv[1], "printResult_double") == 0) {
+        passed = printResultAllocationFree(ARITHMETIC_DOUBLE);
+    } else {
+        cerr << "unknown test " << argv[1] << endl;
+        return 2;
+    }
+    cout << argv[1] << (passed ? ": passed" : ": FAILED") << endl;
+    return passed ? 0 : 1;
+}
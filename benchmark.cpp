@@ -0,0 +1,431 @@
+/* 
+ * File:   benchmark.cpp
+ * Author: John Shelnutt
+ * Synopsis: Micro and macro benchmarks for the tokenizer, parser and evaluator over synthetic expressions, reported as JSON so throughput can be tracked across releases
+ */
+
+#include "Session.h"
+#include "Lexer.h"
+#include "Scan.h"
+#include "Parser.h"
+#include "ExpressionTree.h"
+#include "Columnar.h"
+#include "Snapshot.h"
+#include "Server.h"
+#include "Environment.h"
+#include "AllocationCounter.h"
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <thread>
+#include <unistd.h>
+using namespace std;
+
+// Shape of the synthetic expressions a scenario is built from
+struct Scenario {
+    string name;
+    int operands;     // INT and ID tokens per expression
+    int depth;        // parenthesis nesting depth
+    int variables;    // distinct variable names to draw from
+    string operators; // operator mix, repeat a character to make it more likely
+    int expressions;  // expressions joined with ; for the end-to-end addExpressions benchmark
+};
+
+// Builds an expression of the given number of operands with exactly the given nesting depth
+// Divisors are always non-zero literals so every expression can be evaluated
+string generateExpression(mt19937& rng, const Scenario& sc, int operands, int depth) {
+    string s;
+    for (int i = 0; i < operands; i++) {
+        char op = '+';
+        if (i != 0) {
+            op = sc.operators[rng() % sc.operators.size()];
+            s += op;
+        }
+        
+        if (i == 0 && depth > 0 && operands > 1) {
+            int inner = operands / 2 > 0 ? operands / 2 : 1;
+            s += "(" + generateExpression(rng, sc, inner, depth - 1) + ")";
+            i += inner - 1;
+        } else if (op == '/' || op == '%' || rng() % 2 == 0) {
+            s += to_string(1 + rng() % 99);
+        } else {
+            s += "v" + to_string(rng() % sc.variables);
+        }
+    }
+    return s;
+}
+
+class ExpressionBenchmark {
+public:
+    ExpressionBenchmark(double minSeconds) : minSeconds(minSeconds), first(true) {}
+    void run(const Scenario& sc);
+    void finish();
+private:
+    double minSeconds;
+    bool first;
+    
+    template <class F>
+    void measure(const Scenario& sc, const string& name, F op, size_t tokensPerOp = 0);
+};
+
+/*
+ * Function to time one operation
+ * Doubles the iteration count until a run takes at least minSeconds, then prints one JSON record, with the token
+ * throughput too if the operation reads tokensPerOp tokens
+ */
+template <class F>
+void ExpressionBenchmark::measure(const Scenario& sc, const string& name, F op, size_t tokensPerOp) {
+    unsigned long long iterations = 1;
+    double seconds = 0;
+    unsigned long long allocations = 0;
+    while (true) {
+        unsigned long long allocationsBefore = allocationCount();
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        for (unsigned long long i = 0; i < iterations; i++) {
+            op();
+        }
+        seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        allocations = allocationCount() - allocationsBefore;
+        if (seconds >= minSeconds || iterations >= (1ULL << 40)) {break;}
+        iterations *= 2;
+    }
+    
+    cout << (first ? "\n" : ",\n")
+         << "    {\"benchmark\": \"" << name << "\", \"scenario\": \"" << sc.name << "\""
+         << ", \"operands\": " << sc.operands << ", \"depth\": " << sc.depth
+         << ", \"variables\": " << sc.variables << ", \"operators\": \"" << sc.operators << "\""
+         << ", \"iterations\": " << iterations
+         << ", \"ns_per_op\": " << seconds * 1e9 / iterations
+         << ", \"ops_per_sec\": " << iterations / seconds;
+    if (tokensPerOp != 0) {
+        cout << ", \"tokens_per_sec\": " << iterations * tokensPerOp / seconds;
+    }
+    cout << ", \"allocs_per_op\": " << (double)allocations / iterations << "}";
+    first = false;
+}
+
+void ExpressionBenchmark::run(const Scenario& sc) {
+    mt19937 rng(12345);
+    string source = generateExpression(rng, sc, sc.operands, sc.depth);
+    
+    SymbolTable symbols;
+    Expression e(source, symbols);
+    for (int i = 0; i < sc.variables; i++) {
+        symbols.define(symbols.intern("v" + to_string(i)), 1 + i % 7);
+    }
+    
+    volatile int sink = 0;
+    pmr::vector<Token> tokens;
+    pmr::vector<Token> postfix;
+    ParseError error;
+    tokenize(source, tokens);
+    size_t tokenCount = tokens.size();
+    measure(sc, "tokenize", [&]() {
+        tokens.clear();
+        tokenize(source, tokens);
+    }, tokenCount);
+    
+    // The same with each scanner, the ones the CPU lacks are skipped
+    ScanLevel widest = getScanLevel();
+    for (int level = SCAN_SCALAR; level <= widest; level++) {
+        setScanLevel((ScanLevel)level);
+        measure(sc, string("tokenize_") + scanLevelName((ScanLevel)level), [&]() {
+            tokens.clear();
+            tokenize(source, tokens);
+        }, tokenCount);
+    }
+    setScanLevel(widest);
+    measure(sc, "parse", [&]() {
+        tokens.clear();
+        postfix.clear();
+        sink = parseExpression(source, tokens, postfix, error);
+    });
+    Program program;
+    measure(sc, "compile", [&]() {
+        program.compile(postfix, source, symbols);
+    });
+    Program::set_jit_threshold(0);
+    Expression interpreted(source, symbols);
+    measure(sc, "get_result", [&]() {
+        sink = interpreted.get_result(symbols);
+    });
+    Program::set_jit_threshold(1);
+    Expression native(source, symbols);
+    measure(sc, "get_result_native", [&]() {
+        sink = native.get_result(symbols);
+    });
+    Program::set_jit_threshold(1000);
+    
+    // The other arithmetic policies, always interpreted
+    int64_t wide;
+    int32_t checked;
+    double real;
+    measure(sc, "get_result_int64", [&]() {
+        interpreted.get_result_as<Int64Arithmetic>(symbols, wide);
+        sink = (int)wide;
+    });
+    measure(sc, "get_result_checked", [&]() {
+        interpreted.get_result_as<CheckedInt32Arithmetic>(symbols, checked);
+        sink = checked;
+    });
+    measure(sc, "get_result_double", [&]() {
+        interpreted.get_result_as<DoubleArithmetic>(symbols, real);
+        sink = (int)real;
+    });
+    
+    // The same expression over COLUMN_ROWS rows: columnar kernels against setting the variables and calling get_result per row
+    const size_t COLUMN_ROWS = 4096;
+    vector<vector<int32_t> > columns(sc.variables, vector<int32_t>(COLUMN_ROWS));
+    ColumnBindings bindings(symbols);
+    for (int v = 0; v < sc.variables; v++) {
+        for (size_t r = 0; r < COLUMN_ROWS; r++) {
+            columns[v][r] = (int32_t)(1 + rng() % 1000);
+        }
+        bindings.bind(symbols.intern("v" + to_string(v)), columns[v].data());
+    }
+    vector<int32_t> rowResults(COLUMN_ROWS);
+    measure(sc, "get_results_4096_rows", [&]() {
+        e.get_results(bindings, COLUMN_ROWS, rowResults.data());
+    });
+    SymbolTable rowSymbols = symbols;
+    vector<int> ids;
+    for (int v = 0; v < sc.variables; v++) {
+        ids.push_back(rowSymbols.intern("v" + to_string(v)));
+    }
+    measure(sc, "get_result_4096_rows", [&]() {
+        for (size_t r = 0; r < COLUMN_ROWS; r++) {
+            for (int v = 0; v < sc.variables; v++) {
+                rowSymbols.define(ids[v], columns[v][r]);
+            }
+            rowResults[r] = e.get_result(rowSymbols);
+        }
+    });
+    string out;
+    measure(sc, "setPrefix", [&]() {
+        out.clear();
+        ExpressionTree(postfix).renderPrefix(source, out);
+    });
+    measure(sc, "setParenthesized", [&]() {
+        out.clear();
+        ExpressionTree(postfix).renderParenthesized(source, out);
+    });
+    
+    // End to end: split, parse and record assignments for a whole ;-separated input
+    string input;
+    for (int i = 0; i < sc.expressions; i++) {
+        if (i != 0) {input += ';';}
+        input += i % 8 == 7 ? "v" + to_string(i % sc.variables) + "=" + to_string(1 + i % 9)
+                            : generateExpression(rng, sc, sc.operands, sc.depth);
+    }
+    Session session;
+    measure(sc, "addExpressions", [&]() {
+        session.reset();
+        session.addExpressions(input);
+    });
+    
+    // The same input again and again with the variables kept, the way a batch run over a repetitive feed sees it
+    Session repeated;
+    repeated.addExpressions(input);
+    measure(sc, "addExpressions_repeated", [&]() {
+        repeated.clearExpressions();
+        repeated.addExpressions(input);
+    });
+    string discard;
+    OutputBuffer output(discard);
+    TextSink text(output);
+    JsonSink json(output);
+    measure(sc, "printResult", [&]() {
+        discard.clear();
+        session.printResult(text);
+    });
+    measure(sc, "printResult_ndjson", [&]() {
+        discard.clear();
+        session.printResult(json);
+    });
+    {
+        BinarySink binary(output);
+        measure(sc, "printResult_binary", [&]() {
+            discard.clear();
+            session.printResult(binary);
+        });
+    }
+    
+    // The same sequence from a snapshot: mapping it, = straight from the mapping, and loading it back into a session
+    const string snapshotPath = "calculator_bench.snap";
+    if (session.saveSnapshot(snapshotPath)) {
+        measure(sc, "snapshot_open", [&]() {
+            SnapshotView view;
+            sink = view.open(snapshotPath);
+        });
+        SnapshotView view;
+        view.open(snapshotPath);
+        measure(sc, "snapshot_printResult", [&]() {
+            discard.clear();
+            view.printResult(text);
+        });
+        Session restored;
+        measure(sc, "loadSnapshot", [&]() {
+            restored.loadSnapshot(snapshotPath);
+        });
+        remove(snapshotPath.c_str());
+    }
+    
+    // A sequence built from a few recurring subexpressions, = after every change of a variable: every expression on its
+    // own against the shared subexpression graph. Subexpressions are only joined with + - *, so nothing divides by zero.
+    mt19937 subtermRng(777);
+    vector<string> subterms;
+    for (int i = 0; i < 8; i++) {
+        subterms.push_back("(" + generateExpression(subtermRng, sc, sc.operands / 4 > 1 ? sc.operands / 4 : 2, 0) + ")");
+    }
+    string redundant;
+    for (int i = 0; i < sc.variables; i++) {
+        redundant += "v" + to_string(i) + "=" + to_string(1 + i % 7) + ";";
+    }
+    for (int i = 0; i < sc.expressions; i++) {
+        if (i != 0) {redundant += ';';}
+        for (int t = 0; t < 4; t++) {
+            if (t != 0) {redundant += "+-*"[subtermRng() % 3];}
+            redundant += subterms[subtermRng() % subterms.size()];
+        }
+    }
+    Session separate;
+    separate.addExpressions(redundant);
+    Session sharing;
+    sharing.set_shared_subexpressions(true);
+    sharing.addExpressions(redundant);
+    int flip = 0;
+    measure(sc, "printResult_redundant", [&]() {
+        separate.addExpressions(flip++ % 2 ? "v0=1" : "v0=2");
+        discard.clear();
+        separate.printResult(text);
+    });
+    measure(sc, "printResult_redundant_shared", [&]() {
+        sharing.addExpressions(flip++ % 2 ? "v0=1" : "v0=2");
+        discard.clear();
+        sharing.printResult(text);
+    });
+    
+    // Sessions sharing an environment: publishing an assignment, and = against it alone and while three more readers
+    // and a writer that publishes all the time use the same environment
+    EnvironmentStore environments;
+    Environment& shared = environments.get("bench");
+    Session writer;
+    writer.set_environment(&shared);
+    Session reader;
+    reader.set_environment(&shared);
+    reader.addExpressions(input);
+    int assignment = 0;
+    measure(sc, "environment_update", [&]() {
+        writer.clearExpressions();
+        writer.addExpressions("v0=" + to_string(1 + assignment++ % 9));
+    });
+    measure(sc, "environment_printResult", [&]() {
+        discard.clear();
+        reader.printResult(text);
+    });
+    {
+        atomic<bool> running(true);
+        vector<thread> others;
+        others.push_back(thread([&]() {
+            Session w;
+            w.set_environment(&shared);
+            for (int k = 0; running.load(); k++) {
+                w.clearExpressions();
+                w.addExpressions("v0=" + to_string(1 + k % 9));
+            }
+        }));
+        for (int t = 0; t < 3; t++) {
+            others.push_back(thread([&]() {
+                Session r;
+                r.set_environment(&shared);
+                r.addExpressions(input);
+                string out;
+                OutputBuffer buffer(out);
+                TextSink sinkOut(buffer);
+                while (running.load()) {
+                    out.clear();
+                    r.printResult(sinkOut);
+                }
+            }));
+        }
+        measure(sc, "environment_printResult_contended", [&]() {
+            discard.clear();
+            reader.printResult(text);
+        });
+        running = false;
+        for (thread& t : others) {
+            t.join();
+        }
+    }
+    
+    // 1000 pipelined = requests through the server, until the last reply is read back
+    CalculatorServer server(session);
+    const string socketPath = "calculator_bench.sock";
+    if (server.listen(socketPath)) {
+        thread serving([&]() {server.run();});
+        int fd = connectServer(socketPath);
+        string setup = "s " + source + "\n";
+        char reply[1 << 16];
+        if (fd != -1 && write(fd, setup.data(), setup.size()) == (ssize_t)setup.size() && read(fd, reply, 1) == 1) {
+            string requests;
+            for (int i = 0; i < 1000; i++) {
+                requests += "=\n";
+            }
+            measure(sc, "server_1000_pipelined", [&]() {
+                if (write(fd, requests.data(), requests.size()) != (ssize_t)requests.size()) {return;}
+                int replies = 0;
+                char last = 0;
+                while (replies < 1000) { // every reply ends in an empty line
+                    ssize_t n = read(fd, reply, sizeof(reply));
+                    if (n <= 0) {return;}
+                    for (ssize_t k = 0; k < n; k++) {
+                        if (reply[k] == '\n' && last == '\n') {replies++;}
+                        last = reply[k];
+                    }
+                }
+            });
+        }
+        if (fd != -1) {close(fd);}
+        server.stop();
+        serving.join();
+    }
+    (void)sink;
+}
+
+void ExpressionBenchmark::finish() {
+    cout << "\n  ]\n}" << endl;
+}
+
+int main(int argc, char* argv[]) {
+    double minSeconds = 0.2;
+    string filter;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--min-time") == 0 && i + 1 < argc) {
+            minSeconds = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--filter") == 0 && i + 1 < argc) {
+            filter = argv[++i];
+        } else {
+            cerr << "usage: " << argv[0] << " [--min-time SECONDS] [--filter SCENARIO]" << endl;
+            return 1;
+        }
+    }
+    
+    const Scenario scenarios[] = {
+        {"small", 8, 0, 4, "+-*", 1000},
+        {"medium", 64, 4, 16, "+-*/%", 200},
+        {"large", 1024, 8, 256, "+-*/%", 20},
+        {"long_chain", 100000, 0, 1000, "+", 1},
+    };
+    
+    cout << "{\n  \"column_kernels\": \"" << columnKernelName() << "\",\n  \"benchmarks\": [";
+    ExpressionBenchmark bench(minSeconds);
+    for (const Scenario& sc : scenarios) {
+        if (filter.empty() || filter == sc.name) {
+            bench.run(sc);
+        }
+    }
+    bench.finish();
+    return 0;
+}
@@ -4,58 +4,34 @@
  * Synopsis: Calculator program to parse expressions and perform a handful of functions like parenthesizing statements and evaluating them * 
  */
 
-#include "Token.h"
-#include "Expression.h"
-#include <stack>
+#include "Session.h"
+#include "Stats.h"
+#include "Snapshot.h"
+#include "Server.h"
+#include "Scan.h"
 #include <iostream>
 #include <string>
-#include <vector>
-#include <map>
+#include <fstream>
+#include <chrono>
+#include <cstring>
+#include <cstdlib>
+#include <cerrno>
+#include <cctype>
+#include <climits>
+#include <csignal>
 using namespace std;
 
-map<string, int> variables; // variable look up table
-
-void updateLookupTable(const Expression& e) {
-    // expression e is of the form "a = b", tokenized array is {a, =, b}, where a is the variable name and b is the variable value
-    string variableName = e.get_tokenized()[0].get_token();
-    int variableValue;
-    istringstream stream(e.get_tokenized()[2].get_token());
-    stream >> variableValue;
-    
-    variables.insert(pair<string,int>(variableName, variableValue));
-}
-
-// helper function for debugging - prints all the stored variable names and values
-void printLookupTable() {
-    cout << "contents of the variable look up table: " << endl;
-    for (map<string, int>::iterator it = variables.begin(); it != variables.end(); it++) {
-        cout << it->first << " => " << it->second << endl;
-    }
-}
-
-bool containsUndefinedVariable(Expression e) {
-
-    // Look at every token - if you find a variable and it's not in the look up table, the statement cannot be evaluated
-    for (Token t : e.get_tokenized()) {
-        if (t.get_type() == ID && variables.find(t.get_token()) == variables.end()) {
-            return true;
-        }
-    }
-    
-    return false;
-}
-
 // Function to get valid action input from user
 // input MUST be of length 1 and character entered must be in the set of valid options
 char getValidAction() {
     string input = "";
-    string validCharSet = "=><fFqQcCsS";
+    string validCharSet = "=><fFqQcCsStT";
     
     cout << "action: ";
     cin  >> input;
     
     while (input.length() > 1 || validCharSet.find(input[0]) == string::npos) {
-        cout << "Wrong input for the action! Please type one of =, <, >, f(F), q(Q), c(C), s(S)" << endl;
+        cout << "Wrong input for the action! Please type one of =, <, >, f(F), q(Q), c(C), s(S), t(T)" << endl;
         cout << "action: ";
         cin  >> input;
     }
@@ -63,125 +39,393 @@ char getValidAction() {
     return input[0];
 }
 
-void printResult(const vector<Expression>& expSequence) {
-    for (Expression e : expSequence) {
-        if (e.get_type() != "arithmetic" || containsUndefinedVariable(e)) {
-            cout << "cannot evaluate " << e.get_original() << endl;
-        } else {
-            cout << e.get_original() << " = " << e.get_result(variables) << endl;
-        }  
+void printUsage(const char* program) {
+    cerr << "usage: " << program << " [-b|--batch] [-a|--action =|<|>|f] [-i|--input FILE] [-m|--mmap] [--compact]" << endl
+         << "  -b, --batch    evaluate every line of the input without prompting" << endl
+         << "  -a, --action   action applied to every expression in batch mode (default =)" << endl
+         << "  -i, --input    file to read in batch mode, - for stdin (default -)" << endl
+         << "  -m, --mmap     load the whole input file as one sequence, split on ; and line breaks" << endl
+         << "      --compact  keep only the source text and compiled form of each expression" << endl
+         << "  -j, --threads  threads used to evaluate long sequences, 0 for one per core (default 0)" << endl
+         << "      --jit-threshold  evaluations before an expression is compiled to native code, 0 to never (default 1000)" << endl
+         << "      --parse-cache    bytes of parsed expressions kept for repeated input, 0 to turn off (default 16 MB)" << endl
+         << "      --arithmetic     int32, int64, checked (int32 reporting overflow and division by zero) or double (default int32)" << endl
+         << "      --share          evaluate every distinct subexpression of the sequence once per =, faster when" << endl
+         << "                       expressions repeat subexpressions, otherwise no faster or slightly slower, see ExpressionDag.h" << endl
+         << "      --format         batch output as text, ndjson (one JSON object per line) or binary, see Output.h (default text)" << endl
+         << "      --scan           scalar, sse2 or avx2 character scanning, capped at what the CPU supports (default the widest)" << endl
+         << "      --save-snapshot FILE  with -m, write the loaded sequence and variables to a snapshot file" << endl
+         << "      --snapshot FILE  batch mode on a snapshot file instead of an input file, nothing is parsed" << endl
+         << "      --serve SOCKET   serve sessions on a Unix domain socket until interrupted, see Server.h for the protocol," << endl
+         << "                       int32 arithmetic is checked there and int64 is not served" << endl
+         << "      --connect SOCKET send standard input to a server as requests and print its replies" << endl
+         << "      --stats FILE     where batch mode writes the phase statistics as JSON (default stderr), see the t command" << endl;
+}
+
+// Reads s as a whole decimal number up to max, false for anything else: a sign, other characters after it or overflow
+bool parseCount(const char* s, unsigned long long max, unsigned long long& value) {
+    if (!isdigit((unsigned char)s[0])) {return false;}
+    char* end;
+    errno = 0;
+    value = strtoull(s, &end, 10);
+    return *end == '\0' && errno == 0 && value <= max;
+}
+
+// The driver steps are timed as phases of their own, next to the ones inside Expression
+void addInput(Session& session, const string& input) {
+    STATS_PHASE(PHASE_ADD_EXPRESSIONS);
+    session.addExpressions(input);
+}
+
+void runTimedAction(const Session& session, char action, OutputSink& out) {
+    STATS_PHASE(PHASE_ACTION);
+    session.runAction(action, out);
+}
+
+// Batch mode writes the statistics once at the end of the run, if they are compiled in
+void reportStats(const string& statsPath) {
+    if (!statsEnabled()) {return;}
+    if (statsPath.empty()) {
+        writeStatsJson(cerr);
+        return;
+    }
+    ofstream file(statsPath.c_str());
+    if (!file) {
+        cerr << "cannot write " << statsPath << endl;
+        return;
     }
+    writeStatsJson(file);
 }
 
-void printPrefix(const vector<Expression>& expSequence) {
-    for (Expression e : expSequence) {
-        if (e.get_type() == "arithmetic") {
-            cout << "prefix of " << e.get_original() << " is: " << e.get_prefix() << endl;           
-        } else {
-            cout << e.get_original() << " is not arithmetic and has no prefix" << endl;
-        }
+/*
+ * Batch mode for large files: the whole file is one sequence, memory mapped and parsed in parallel by Session::loadFile
+ */
+int runMapped(Session& session, char action, const string& inputPath, OutputSink& out) {
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    bool loadedFile;
+    {
+        STATS_PHASE(PHASE_LOAD_FILE);
+        loadedFile = session.loadFile(inputPath);
+    }
+    if (!loadedFile) {
+        cerr << "cannot open " << inputPath << endl;
+        return 1;
+    }
+    double loaded = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    runTimedAction(session, action, out);
+    out.flush();
+    
+    size_t count = session.get_expressions().size();
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    cerr << count << " expressions in " << seconds << " s, " << loaded << " s loading ("
+         << (seconds > 0 ? count / seconds : 0) << " expressions/sec)" << endl;
+    
+    const ExpressionDag& dag = session.get_dag();
+    if (dag.size() != 0) {
+        cerr << "shared subexpressions: " << dag.get_node_count() << " nodes for " << dag.get_instruction_count()
+             << " instructions, " << dag.get_operations() << " operations in the last =" << endl;
     }
+    return 0;
 }
 
-void printPostfix(const vector<Expression>& expSequence) {
-    for (Expression e : expSequence) {
-        if (e.get_type() == "arithmetic") {
-            cout << "postfix of " << e.get_original() << " is: ";
-            for (Token t : e.get_postfix()) {
-                cout << t.get_token() << ' ';
-            }
-            cout << endl;            
-        } else {
-            cout << e.get_original() << " is not arithmetic and has no postfix" << endl;
+// The running server, so SIGINT and SIGTERM can stop it and the socket file is removed
+CalculatorServer* activeServer = nullptr;
+
+void stopServer(int) {
+    if (activeServer) {
+        activeServer->stop();
+    }
+}
+
+int runServer(const Session& settings, const string& socketPath) {
+    CalculatorServer server(settings);
+    if (!server.listen(socketPath)) {
+        cerr << "cannot listen on " << socketPath << endl;
+        return 1;
+    }
+    activeServer = &server;
+    signal(SIGINT, stopServer);
+    signal(SIGTERM, stopServer);
+    server.run();
+    activeServer = nullptr;
+    return 0;
+}
+
+/*
+ * Batch mode on a snapshot: = evaluates straight out of the mapped file under the session's arithmetic, the other
+ * actions and = with --share need the expressions loaded into the session, which still only copies the saved programs
+ */
+int runSnapshot(Session& session, char action, const string& snapshotPath, OutputSink& out) {
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    SnapshotView view;
+    size_t count;
+    bool fromMapping = action == '=' && !session.get_shared_subexpressions(); // the graph needs the expressions loaded
+    if (fromMapping) {
+        if (!view.open(snapshotPath)) {
+            cerr << "cannot read snapshot " << snapshotPath << endl;
+            return 1;
         }
+        count = view.size();
+    } else {
+        if (!session.loadSnapshot(snapshotPath)) {
+            cerr << "cannot read snapshot " << snapshotPath << endl;
+            return 1;
+        }
+        count = session.get_expressions().size();
     }
+    double loaded = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    if (fromMapping) {
+        STATS_PHASE(PHASE_ACTION);
+        view.printResult(out, session.get_arithmetic());
+    } else {
+        runTimedAction(session, action, out);
+    }
+    out.flush();
+    
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    cerr << count << " expressions in " << seconds << " s, " << loaded << " s loading ("
+         << (seconds > 0 ? count / seconds : 0) << " expressions/sec)" << endl;
+    return 0;
 }
 
-void printParenthesized(const vector<Expression>& expSequence) {
-    for (Expression e : expSequence) {
-        if (e.get_type() == "arithmetic") {
-            cout << "fully parenthesizing " << e.get_original() << " is: " << e.get_parenthesized() << endl;           
-        } else {
-            cout << e.get_original() << " cannot be parenthesized" << endl;
+/*
+ * Non-interactive mode: every input line is a ;-separated sequence of expressions that is added the same way
+ * the c command does, then the chosen action is applied to it. Variables persist across lines, expressions do not.
+ */
+int runLines(Session& session, char action, const string& inputPath, OutputSink& out) {
+    ifstream file;
+    if (inputPath != "-") {
+        file.open(inputPath.c_str());
+        if (!file) {
+            cerr << "cannot open " << inputPath << endl;
+            return 1;
+        }
+    }
+    istream& in = inputPath == "-" ? cin : file;
+    
+    string line;
+    unsigned long long count = 0;
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    
+    while (getline(in, line)) {
+        if (!line.empty() && line[line.length() - 1] == '\r') {
+            line.erase(line.length() - 1);
         }
+        if (line.empty()) {continue;}
+        
+        addInput(session, line);
+        runTimedAction(session, action, out);
+        count += session.get_expressions().size();
+        session.clearExpressions();
+    }
+    out.flush();
+    
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    cerr << count << " expressions in " << seconds << " s ("
+         << (seconds > 0 ? count / seconds : 0) << " expressions/sec)" << endl;
+    
+    const ParseCache& cache = session.get_parse_cache();
+    if (cache.get_memory_limit() != 0) {
+        cerr << "parse cache: " << cache.get_hits() << " hits, " << cache.get_misses() << " misses, "
+             << cache.get_evictions() << " evictions, " << cache.size() << " forms in " << cache.get_memory() << " bytes" << endl;
     }
+    return 0;
 }
 
-// Breaks up input into sequence of expressions, then adds assignment values to variable look up table
-void addExpressions(vector<Expression>& expressions, const string& s) {
-    Expression e;
-    int nextExpBreak = s.find(';');
-    
-    // Base case: If input does not contain a semicolon (or it is at the end), assume one statement and push whole string
-    if (nextExpBreak == string::npos) {
-        e = Expression(s);
-        expressions.push_back(e);
-    } else if (nextExpBreak == s.length() - 1) {
-        e = Expression(s.substr(0, s.length() - 1));
-        expressions.push_back(e);
-    // Recursive case: If semicolon was found and it is NOT the last character, then there must be another statement
-    //                 Recurse with the remainder of the string starting right after that semicolon position
+/*
+ * Batch mode: output is formatted by the sink for format into a 1 MB buffer on standard output, written when it fills
+ * up or at the end of the run
+ */
+int runBatch(Session& session, char action, const string& inputPath, bool mapped, const string& snapshotPath, OutputFormat format) {
+    ios::sync_with_stdio(false);
+    cin.tie(nullptr);
+    OutputBuffer output(1, 1 << 20);
+    unique_ptr<OutputSink> out = makeSink(format, output);
+    int status;
+    if (!snapshotPath.empty()) {
+        status = runSnapshot(session, action, snapshotPath, *out);
+    } else if (mapped) {
+        status = runMapped(session, action, inputPath, *out);
     } else {
-        e = Expression(s.substr(0, nextExpBreak));
-        expressions.push_back(e);
-        addExpressions(expressions, s.substr(nextExpBreak + 1));
+        status = runLines(session, action, inputPath, *out);
     }
-    
-    // Add assignment value to look up table (if expression is an assignment statement)
-    if (e.get_type() == "assignment") {
-        updateLookupTable(e);
+    output.flush();
+    if (output.failed()) {
+        cerr << "cannot write output" << endl;
+        return 1;
     }
+    return status;
 }
 
-int main() {
-    vector<Expression> expSequence;
+int main(int argc, char* argv[]) {
+    Session session;
     string input;
     char action;
     
+    bool batch = false;
+    char batchAction = '=';
+    string inputPath = "-";
+    bool mapped = false;
+    string statsPath;
+    string snapshotPath;
+    string saveSnapshotPath;
+    string servePath;
+    string connectPath;
+    OutputFormat format = OUTPUT_TEXT;
+    unsigned long long count;
+    startHardwareCounters();
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-b") == 0 || strcmp(argv[i], "--batch") == 0) {
+            batch = true;
+        } else if ((strcmp(argv[i], "-a") == 0 || strcmp(argv[i], "--action") == 0) && i + 1 < argc) {
+            string a = argv[++i];
+            if (a.length() != 1 || string("=<>fF").find(a[0]) == string::npos) {
+                printUsage(argv[0]);
+                return 1;
+            }
+            batchAction = a[0];
+        } else if (strcmp(argv[i], "-m") == 0 || strcmp(argv[i], "--mmap") == 0) {
+            mapped = true;
+        } else if (strcmp(argv[i], "--compact") == 0) {
+            session.set_compact(true);
+        } else if ((strcmp(argv[i], "-j") == 0 || strcmp(argv[i], "--threads") == 0) && i + 1 < argc) {
+            if (!parseCount(argv[++i], UINT_MAX, count)) {
+                printUsage(argv[0]);
+                return 1;
+            }
+            session.set_threads((unsigned)count);
+        } else if (strcmp(argv[i], "--parse-cache") == 0 && i + 1 < argc) {
+            if (!parseCount(argv[++i], SIZE_MAX, count)) {
+                printUsage(argv[0]);
+                return 1;
+            }
+            session.set_parse_cache_limit((size_t)count);
+        } else if (strcmp(argv[i], "--arithmetic") == 0 && i + 1 < argc) {
+            string a = argv[++i];
+            if (a == "int32") {
+                session.set_arithmetic(ARITHMETIC_INT32);
+            } else if (a == "int64") {
+                session.set_arithmetic(ARITHMETIC_INT64);
+            } else if (a == "checked") {
+                session.set_arithmetic(ARITHMETIC_CHECKED);
+            } else if (a == "double") {
+                session.set_arithmetic(ARITHMETIC_DOUBLE);
+            } else {
+                printUsage(argv[0]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--format") == 0 && i + 1 < argc) {
+            string f = argv[++i];
+            if (f == "text") {
+                format = OUTPUT_TEXT;
+            } else if (f == "ndjson") {
+                format = OUTPUT_NDJSON;
+            } else if (f == "binary") {
+                format = OUTPUT_BINARY;
+            } else {
+                printUsage(argv[0]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--share") == 0) {
+            session.set_shared_subexpressions(true);
+        } else if (strcmp(argv[i], "--scan") == 0 && i + 1 < argc) {
+            string level = argv[++i];
+            if (level == "scalar") {
+                setScanLevel(SCAN_SCALAR);
+            } else if (level == "sse2") {
+                setScanLevel(SCAN_SSE2);
+            } else if (level == "avx2") {
+                setScanLevel(SCAN_AVX2);
+            } else {
+                printUsage(argv[0]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--jit-threshold") == 0 && i + 1 < argc) {
+            if (!parseCount(argv[++i], UINT_MAX, count)) {
+                printUsage(argv[0]);
+                return 1;
+            }
+            Program::set_jit_threshold((unsigned)count);
+        } else if (strcmp(argv[i], "--snapshot") == 0 && i + 1 < argc) {
+            snapshotPath = argv[++i];
+        } else if (strcmp(argv[i], "--save-snapshot") == 0 && i + 1 < argc) {
+            saveSnapshotPath = argv[++i];
+        } else if (strcmp(argv[i], "--serve") == 0 && i + 1 < argc) {
+            servePath = argv[++i];
+        } else if (strcmp(argv[i], "--connect") == 0 && i + 1 < argc) {
+            connectPath = argv[++i];
+        } else if (strcmp(argv[i], "--stats") == 0 && i + 1 < argc) {
+            statsPath = argv[++i];
+        } else if ((strcmp(argv[i], "-i") == 0 || strcmp(argv[i], "--input") == 0) && i + 1 < argc) {
+            inputPath = argv[++i];
+        } else {
+            printUsage(argv[0]);
+            return 1;
+        }
+    }
+    
+    if (!batch && (!snapshotPath.empty() || !saveSnapshotPath.empty())) { // snapshots are batch mode only
+        printUsage(argv[0]);
+        return 1;
+    }
+    if (!servePath.empty()) {
+        if (session.get_arithmetic() == ARITHMETIC_INT64) { // would trap on /0, and checking it would narrow it
+            printUsage(argv[0]);
+            return 1;
+        }
+        return runServer(session, servePath);
+    }
+    if (!connectPath.empty()) {
+        return runClient(connectPath, 0, 1);
+    }
+    
+    if (batch) {
+        if ((mapped && inputPath == "-") || (!saveSnapshotPath.empty() && (!mapped || !snapshotPath.empty()))) {
+            printUsage(argv[0]);
+            return 1;
+        }
+        int status = runBatch(session, batchAction, inputPath, mapped, snapshotPath, format);
+        if (status == 0 && !saveSnapshotPath.empty() && !session.saveSnapshot(saveSnapshotPath)) {
+            cerr << "cannot write snapshot " << saveSnapshotPath << endl;
+            status = 1;
+        }
+        reportStats(statsPath);
+        return status;
+    }
+    
+    // The interactive prompt always prints text, handed to cout after every action
+    OutputBuffer output(cout);
+    TextSink out(output);
     cout << "=== expression evaluation program starts ===" << endl;
     
     cout << "input: ";
     cin  >> input;
-    addExpressions(expSequence, input);
+    addInput(session, input);
     
-    do {
+    while (true) {
         action = getValidAction();
+        if (action == 'q' || action == 'Q') {break;} // nothing to run, so no phase sample for it either
 
         // Handle action inputs here
-        if (action == '=') {
-            printResult(expSequence);                
-        } else if (action == '>') {
-            printPrefix(expSequence);     
-        } else if (action == '<') {
-            printPostfix(expSequence);
-        } else if (action == 'f' || action == 'F') {
-            printParenthesized(expSequence);
-        } else if (action == 's' || action == 'S') {
-            variables.clear();
+        if (action == 's' || action == 'S') {
+            session.reset();
             cout << "input: ";
             cin  >> input;
-            expSequence.clear();
-            addExpressions(expSequence, input);
+            addInput(session, input);
         } else if (action == 'c' || action == 'C') {
             cout << "input: ";
             cin  >> input;
-            addExpressions(expSequence, input);
+            addInput(session, input);
+        } else if (action == 't' || action == 'T') {
+            printStats(cout);
+        } else {
+            runTimedAction(session, action, out);
+            out.flush();
         }
         
-//        printLookupTable(); // Print the contents of the variable map for testing purposes
+//        session.printLookupTable(cout); // Print the contents of the variable map for testing purposes
         
-    } while (action != 'q' && action != 'Q');
+    }
     
     return 0;
 }
-
-
-
-
-
-
-
-
-
-
-